@@ -0,0 +1,35 @@
+#ifndef __CHANNELIZER_H__
+#define __CHANNELIZER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Splits the full-rate RTL stream into every channel on a fixed grid around
+ * the tuned frequency with one polyphase filterbank, measures the power in
+ * each and FM-demodulates the channels that are enabled. Channel k
+ * (0 <= k < num_channels) is centered (k - num_channels/2) * spacing from
+ * the tuned frequency.
+ */
+
+typedef struct channelizer_s * channelizer;
+
+channelizer channelizer_create(int input_rate, int spacing, int output_rate);
+void channelizer_destroy(channelizer ch);
+void channelizer_execute(channelizer ch, const uint8_t * x, unsigned int n);
+void channelizer_reset(channelizer ch);
+
+int channelizer_get_input_rate(channelizer ch);
+int channelizer_get_output_rate(channelizer ch);
+int channelizer_get_num_channels(channelizer ch);
+int channelizer_get_offset(channelizer ch, int k);
+int channelizer_lookup_channel(channelizer ch, int offset);
+
+bool channelizer_get_enabled(channelizer ch, int k);
+void channelizer_set_enabled(channelizer ch, int k, bool enabled);
+
+bool channelizer_is_measured(channelizer ch);
+float channelizer_get_power(channelizer ch, int k);
+int channelizer_get_output(channelizer ch, int k, int16_t ** buf);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Cheap encodings of the int16 output audio for clients on slow links,
+ * optionally after decimating it by a small integer factor:
+ *
+ *   PCM16  little-endian int16
+ *   ULAW   G.711 mu-law, a byte per sample
+ *   ALAW   G.711 A-law, a byte per sample
+ *   ADPCM  IMA ADPCM, 4 bits per sample after a 4 byte header: the
+ *          predictor (int16) and step index (uint8) it starts from, and
+ *          whether the last nibble is padding (uint8), so every block can be
+ *          decoded on its own
+ */
+
+typedef enum { CODEC_PCM16, CODEC_ULAW, CODEC_ALAW, CODEC_ADPCM,
+	       CODEC_NUM_TYPES } codec_type;
+
+#define CODEC_MAX_DECIM 16
+
+typedef struct codec_s * codec;
+
+codec codec_create(codec_type type, unsigned int decim);
+void codec_destroy(codec c);
+void codec_reset(codec c);
+
+const char * codec_lookup_type_name(codec_type type);
+codec_type codec_lookup_type(const char * s); // CODEC_NUM_TYPES if unknown
+
+codec_type codec_get_type(codec c);
+unsigned int codec_get_decim(codec c);
+
+// type and decimation in 7 bits, (decim - 1) << 3 | type, for the client
+uint8_t codec_get_format(codec c);
+
+// most bytes encoding n samples can give
+size_t codec_get_max_size(codec c, unsigned int n);
+
+// encodes n samples to y, returns the number of bytes written (and how many
+// samples they are after decimation in m)
+size_t codec_encode(codec c, const int16_t * x, unsigned int n, uint8_t * y,
+		    unsigned int * m);
+
+// n samples of silence, returns how many samples they are after decimation
+unsigned int codec_skip(codec c, unsigned int n);
+
+#endif
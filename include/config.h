@@ -2,6 +2,41 @@
 #define __CONFIG_H__
 
 #define SCANNER_THRESHOLD 8.0f /* dB */
-#define SQUELCH_THRESHOLD 6.0f /* dB */
+#define SQUELCH_THRESHOLD 6.0f /* dB, SNR the squelch opens at */
+#define SQUELCH_HYSTERESIS 3.0f /* dB below the threshold it closes at */
+#define SQUELCH_HOLD 4 /* blocks below that before it closes */
+
+#define DEMOD_INPUT_DEPTH 8 /* blocks buffered between RTL and demod */
+#define DEMOD_STAGE_DEPTH 4 /* blocks buffered between demod stages */
+#define DEMOD_OUTPUT_DEPTH 8 /* output blocks kept for readers (power of 2) */
+/* output blocks readers can hold at once (the websocket holds up to
+ * WEBSOCKET_CLIENT_DEPTH plus one being written to each client) */
+#define DEMOD_OUTPUT_READERS 12
+
+/* demodulate with integer arithmetic only (for CPUs without a fast FPU);
+ * can be changed at run time with app -x */
+#define DEMOD_FIXED_POINT 0
+
+#define FILTERCACHE_SIZE 16 /* designed resamplers kept for reuse */
+
+#define STATIONCACHE_SIZE 128 /* stations remembered per mode */
+/* where they're kept between runs, can be changed at run time with app -t */
+#define STATIONCACHE_PATH "stations.dat"
+
+#define WEBSOCKET_MAX_CLIENTS 8 /* listeners at once, others are refused */
+#define WEBSOCKET_CLIENT_DEPTH 4 /* frames queued per client before dropping */
+
+/* input spectrum estimate (Welch), used for SNR */
+#define DEMOD_SPECTRUM_SIZE 1024 /* FFT length */
+#define DEMOD_SPECTRUM_SEGMENTS 8 /* averaged per estimate, 50% overlap */
+#define DEMOD_SPECTRUM_CADENCE 2 /* analyze every Nth block */
+#define DEMOD_SPECTRUM_STEP 10 /* use every Nth sample */
+#define DEMOD_SPECTRUM_SIGNAL_BW 250.0f /* Hz either side of DC */
+
+/* spectrum of the whole capture sent to clients that ask for it */
+#define DEMOD_DISPLAY_CADENCE 4 /* every Nth block, a multiple of the above */
+#define WEBSOCKET_SPECTRUM_MAX_RATE 30 /* frames/s per client */
+#define WEBSOCKET_SPECTRUM_MIN_DB -100.0f /* quantized to 0 */
+#define WEBSOCKET_SPECTRUM_MAX_DB 0.0f /* quantized to 255 */
 
 #endif
@@ -12,6 +12,6 @@ controller controller_create(demod dem, rtl r, scanner scan, websocket ws);
 void controller_destroy(controller ctrl);
 void controller_execute(controller ctrl);
 
-void controller_command(controller ctrl, char * cmd, int len);
+void controller_command(controller ctrl, int client, char * cmd, int len);
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef __CONVERT_H__
+#define __CONVERT_H__
+
+#include <complex.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sample conversion kernels for the hot path. convert_init picks the best
+ * implementation the CPU supports (scalar, SSE2, AVX2 or NEON); until it's
+ * called the scalar versions are used.
+ */
+
+void convert_init();
+const char * convert_get_name();
+
+// n interleaved unsigned 8-bit IQ pairs (as delivered by the RTL) to complex
+// floats, centered on zero
+void convert_u8_to_cf(const uint8_t * x, float complex * y, size_t n);
+
+// scale and saturate n floats to int16 (rounding toward zero)
+void convert_f_to_s16(const float * x, int16_t * y, size_t n, float scale);
+
+#endif
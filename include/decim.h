@@ -0,0 +1,38 @@
+#ifndef __DECIM_H__
+#define __DECIM_H__
+
+#include <complex.h>
+#include <stdint.h>
+
+/**
+ * Integer front end for decimating raw RTL samples by a power of two: a
+ * fourth order CIC decimator by 2^(k-1) followed by a half-band filter
+ * decimating by 2, all in int32, with only the decimated output converted to
+ * float (in the same units as convert_u8_to_cf). Whatever's left of the
+ * decimation is up to a float resampler.
+ */
+
+typedef struct decim_s * decim;
+
+decim decim_create(unsigned int log2_factor, unsigned int max_input);
+void decim_destroy(decim d);
+void decim_reset(decim d);
+
+// largest power of two decimation that still leaves r (0 < r <= 1) no more
+// than halved, i.e. r * 2^k stays in (0.5, 1]
+unsigned int decim_lookup_log2_factor(float r);
+
+// arithmetic operations per input sample, for comparing against other
+// front ends
+float decim_estimate_cost(unsigned int log2_factor);
+
+unsigned int decim_get_factor(decim d);
+
+// n unsigned 8-bit IQ pairs straight from the RTL
+void decim_execute_cu8(decim d,
+		       const uint8_t * x,
+		       unsigned int n,
+		       float complex * y,
+		       unsigned int * ny);
+
+#endif
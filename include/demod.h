@@ -3,14 +3,37 @@
 
 #include <pthread.h>
 #include <rtl-sdr.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "rtl.h"
 
 typedef enum { DEMOD_NONE, DEMOD_FM, DEMOD_AM } demod_mode;
 
+// how the first (largest) decimation is filtered
+typedef enum { DEMOD_FILTER_AUTO, DEMOD_FILTER_TIME, DEMOD_FILTER_FFT }
+  demod_filter;
+
+// threads the demod is split into, each passing blocks to the next through
+// a bounded queue (metrics and the channel monitor run off to the side, on
+// copies of the input)
+typedef enum { DEMOD_STAGE_FRONT, DEMOD_STAGE_DETECT, DEMOD_STAGE_AUDIO,
+	       DEMOD_STAGE_METRICS, DEMOD_STAGE_CHANNELS, DEMOD_NUM_STAGES }
+  demod_stage;
+
 typedef struct demod_s * demod;
 
+// a block of output audio, shared by every reader that acquires it
+struct demod_block_s
+{
+  uint32_t seq;
+  struct timespec time; // when it was produced
+  bool silent; // len samples of silence, data isn't touched
+  int len;
+  int16_t * data; // with the padding set by demod_set_output_padding around it
+};
+
 demod demod_create();
 void demod_destroy(demod dem);
 void demod_execute(demod dem);
@@ -28,18 +51,39 @@ const char * demod_get_mode_name(demod dem);
 void demod_set_mode(demod dem, demod_mode mode);
 uint32_t demod_get_center_freq(demod dem);
 void demod_set_center_freq(demod dem, uint32_t center_freq);
+void demod_set_reset_on_retune(demod dem, bool reset);
+void demod_set_fixed_point(demod dem, bool fixed_point);
+void demod_set_filter(demod dem, demod_mode mode, demod_filter filter);
 int demod_get_input_rate(demod dem);
 void demod_set_input_rate(demod dem, int input_rate);
 int demod_get_output_rate(demod dem);
 void demod_set_output_rate(demod dem, int output_rate);
 
 float demod_get_snr(demod dem);
+int demod_get_spectrum(demod dem, float * buf, int len);
+unsigned int demod_get_snr_stats(demod dem, uint32_t tune_gen, float * mean,
+				 float * deviation);
+void demod_set_wideband_spectrum(demod dem, bool wideband);
+void demod_set_display_spectrum(demod dem, bool enabled);
+int demod_get_display_spectrum(demod dem, float * buf, int len,
+			       unsigned int * gen);
+float demod_get_display_rate(demod dem);
 float demod_get_throughput(demod dem);
+void demod_set_channel_monitor(demod dem, bool enabled);
+void demod_set_listen_freq(demod dem, uint32_t center_freq);
+bool demod_get_channel(demod dem, int k, uint32_t * center_freq, float * power);
+
+unsigned int demod_get_overruns(demod dem);
+unsigned int demod_get_underruns(demod dem);
 
-void demod_pop_and_lock(demod dem,
-			int16_t ** buf,
-			int * len);
-void demod_push(demod dem, int8_t * buf, int len);
-void demod_release(demod dem);
+uint32_t demod_get_output_seq(demod dem);
+const struct demod_block_s * demod_acquire_block(demod dem,
+						 uint32_t * next,
+						 unsigned int * skipped);
+void demod_release_block(demod dem, const struct demod_block_s * block);
+void demod_push(demod dem, uint8_t * buf, int len, uint32_t tune_gen);
+void demod_set_input_blocking(demod dem, bool blocking);
+void demod_set_stage_cpu(demod dem, demod_stage stage, int cpu);
+void demod_set_output_padding(demod dem, size_t headroom, size_t tailroom);
 
 #endif
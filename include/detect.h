@@ -0,0 +1,58 @@
+#ifndef __DETECT_H__
+#define __DETECT_H__
+
+#include <complex.h>
+#include <stdint.h>
+
+/**
+ * Block detectors for the post-decimation stage. They work on a whole buffer
+ * at a time; any state carried between blocks is owned by the caller.
+ */
+
+// atan2 approximation used by the FM detector, |error| < 2e-5 rad
+float detect_atan2(float y, float x);
+
+// polar discriminator, y[i] = gain * arg(x[i] * conj(x[i-1])); *prev holds
+// the last sample of the previous block and is updated
+void detect_fm(const float complex * x,
+	       unsigned int n,
+	       float complex * prev,
+	       float gain,
+	       float * y);
+
+// envelope detector with carrier removal, y[i] = (|x[i]| - c) / c where c is
+// the carrier level tracked by a one-pole average (*carrier, updated; 0
+// starts it from the block's mean)
+void detect_am(const float complex * x,
+	       unsigned int n,
+	       float * carrier,
+	       float alpha,
+	       float * y);
+
+/*
+ * Fixed-point versions for CPUs with a slow FPU. Samples are interleaved
+ * int16 IQ; angles are int16 with 32768 standing for pi.
+ */
+
+// CORDIC atan2, |error| < 4 (about 4e-4 rad); *mag (if not NULL) gets |(x, y)|
+int16_t detect_atan2_q15(int32_t y, int32_t x, int32_t * mag);
+
+// polar discriminator, same scaling as detect_fm with gain 1 / (2 pi) and an
+// output scale of 32768; *phase holds the phase of the previous sample
+void detect_fm_q15(const int16_t * x,
+		   unsigned int n,
+		   int16_t * phase,
+		   int16_t * y);
+
+// envelope detector, y[i] = gain * (|x[i]| - c) / c0 with gain in Q15, the
+// carrier level (*carrier, Q8, updated; 0 starts it from the block's mean)
+// tracked with a 2^-alpha_shift pole and c0 its level at the start of the
+// block
+void detect_am_q15(const int16_t * x,
+		   unsigned int n,
+		   int32_t * carrier,
+		   unsigned int alpha_shift,
+		   int16_t gain,
+		   int16_t * y);
+
+#endif
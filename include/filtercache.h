@@ -0,0 +1,26 @@
+#ifndef __FILTERCACHE_H__
+#define __FILTERCACHE_H__
+
+#include <liquid/liquid.h>
+
+/**
+ * Keeps designed resamplers around after they're released, keyed by their
+ * design parameters, so switching back to a rate or mode that's been used
+ * before doesn't redo the Kaiser filter design. Objects handed out are reset
+ * and owned by the caller until they're put back. Safe to use from any
+ * thread.
+ */
+
+msresamp_crcf filtercache_get_msresamp(float r, float As);
+void filtercache_put_msresamp(msresamp_crcf q);
+
+resamp_rrrf filtercache_get_resamp(float r,
+				   unsigned int h_len,
+				   float fc,
+				   float As,
+				   unsigned int npfb);
+void filtercache_put_resamp(resamp_rrrf q);
+
+void filtercache_clear();
+
+#endif
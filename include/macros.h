@@ -6,6 +6,9 @@
 #define DEBUG(...) fprintf(stdout, __VA_ARGS__);
 #define ERROR(...) fprintf(stderr, __VA_ARGS__);
 
+// used to pad structures shared between threads (avoids false sharing)
+#define CACHE_LINE_SIZE 64
+
 // pthread helpers (from rtl_fm.c)
 #define safe_cond_signal(n, m) \
   pthread_mutex_lock(m); \
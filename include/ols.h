@@ -0,0 +1,39 @@
+#ifndef __OLS_H__
+#define __OLS_H__
+
+#include <complex.h>
+#include <stdint.h>
+
+/**
+ * Fast-convolution (overlap-save) low-pass filter decimating by an integer
+ * factor D. Each FFT block is filtered in the frequency domain, the spectrum
+ * is folded D ways and only the decimated output is transformed back, so the
+ * inverse FFT is D times shorter. The FFT plans are made once, in
+ * ols_create.
+ */
+
+typedef struct ols_s * ols;
+
+// fc is the cutoff relative to the input rate, the transition band runs from
+// fc - df/2 to fc + df/2
+ols ols_create(unsigned int D, float fc, float df, float As);
+void ols_destroy(ols q);
+void ols_reset(ols q);
+
+// floating point operations per input sample, for comparing against a
+// time-domain filter
+float ols_estimate_cost(unsigned int D, float df, float As);
+
+unsigned int ols_get_decim_factor(ols q);
+
+// most outputs n inputs can produce
+unsigned int ols_get_max_output(ols q, unsigned int n);
+
+// n unsigned 8-bit IQ pairs straight from the RTL
+void ols_execute_cu8(ols q,
+		     const uint8_t * x,
+		     unsigned int n,
+		     float complex * y,
+		     unsigned int * ny);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __QRESAMP_H__
+#define __QRESAMP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Fixed-point polyphase resampler for decimation (r <= 1), for CPUs where
+ * float is slow. Taps are designed in float once (Kaiser) and quantized to
+ * Q15; filtering uses int16 samples and int32 accumulators. The filter is
+ * evaluated at the nearest of npfb phases, no interpolation between them.
+ *
+ * Complex resamplers take interleaved IQ; real ones take plain samples. Each
+ * output is the accumulator shifted right by `shift`: 15 keeps the input
+ * scale, less gives the extra precision the averaging has bought.
+ */
+
+typedef struct qresamp_s * qresamp;
+
+qresamp qresamp_create(float r,
+		       float bw,
+		       float As,
+		       unsigned int npfb,
+		       unsigned int shift,
+		       bool cplx,
+		       unsigned int max_input);
+void qresamp_destroy(qresamp q);
+void qresamp_reset(qresamp q);
+
+// n unsigned 8-bit IQ pairs straight from the RTL (complex only)
+void qresamp_execute_cu8(qresamp q,
+			 const uint8_t * x,
+			 unsigned int n,
+			 int16_t * y,
+			 unsigned int * ny);
+
+// n int16 IQ pairs (complex) or samples (real)
+void qresamp_execute_s16(qresamp q,
+			 const int16_t * x,
+			 unsigned int n,
+			 int16_t * y,
+			 unsigned int * ny);
+
+#endif
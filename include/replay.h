@@ -0,0 +1,31 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <rtl-sdr.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Plays back recorded 8-bit unsigned IQ (rtl_sdr .bin or SigMF cu8) through
+ * the same calls the rtl module makes on a librtlsdr device, so it can stand
+ * in for a dongle.
+ */
+
+typedef struct replay_s * replay;
+
+replay replay_open(const char * path, bool paced);
+void replay_close(replay rp);
+
+int replay_read_async(replay rp,
+		      rtlsdr_read_async_cb_t cb,
+		      void * ctx,
+		      uint32_t buf_len);
+int replay_cancel_async(replay rp);
+
+bool replay_is_paced(replay rp);
+uint32_t replay_get_center_freq(replay rp);
+int replay_set_center_freq(replay rp, uint32_t center_freq);
+uint32_t replay_get_sample_rate(replay rp);
+int replay_set_sample_rate(replay rp, uint32_t sample_rate);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A fixed-capacity, lock-free, single-producer/single-consumer ring of
+ * blocks. The producer fills a slot obtained with ring_acquire and publishes
+ * it with ring_commit; the consumer reads the oldest slot with ring_peek and
+ * hands it back with ring_release.
+ */
+
+struct ring_block_s
+{
+  // assigned by the producer, increments for every block offered (including
+  // ones dropped because the ring was full), so gaps mark lost blocks
+  uint32_t seq;
+
+  // the producer's own label for the block, carried along untouched
+  uint32_t tag;
+
+  // number of valid bytes in data
+  size_t size;
+  void * data;
+};
+
+typedef struct ring_s * ring;
+
+ring ring_create(unsigned int depth, size_t block_size);
+void ring_destroy(ring rb);
+
+struct ring_block_s * ring_acquire(ring rb);
+void ring_commit(ring rb);
+bool ring_push(ring rb, void * buf, size_t size, uint32_t tag);
+
+struct ring_block_s * ring_peek(ring rb);
+void ring_release(ring rb);
+
+bool ring_is_full(ring rb);
+unsigned int ring_get_overruns(ring rb);
+unsigned int ring_get_underruns(ring rb);
+
+#endif
@@ -2,19 +2,26 @@
 #define __RTL_SOURCE_H__
 
 #include <rtl-sdr.h>
+#include <stdbool.h>
 
 #define RTL_DEFAULT_SAMPLE_RATE 24000
 #define RTL_DEFAULT_BUFFER_LENGTH 16384
 #define RTL_MAX_OVERSAMPLE 16
 #define RTL_MAX_BUFFER_LENGTH (RTL_MAX_OVERSAMPLE * RTL_DEFAULT_BUFFER_LENGTH)
 
-typedef void (* rtl_execute_callback)(int8_t * buf, int len, void * ctx);
+// buf holds interleaved unsigned 8-bit IQ, exactly as the dongle sends it;
+// tune_gen is the tuning it was captured under (see rtl_get_tune_gen)
+typedef void (* rtl_execute_callback)(uint8_t * buf, int len, uint32_t tune_gen,
+				      void * ctx);
 typedef struct rtl_s * rtl;
 
 rtl rtl_create(int device_index);
+rtl rtl_create_replay(const char * path, bool paced);
 void rtl_destroy(rtl r);
 void rtl_execute(rtl r, rtl_execute_callback cb, void * ctx);
 
+bool rtl_is_realtime(rtl r);
+uint32_t rtl_get_tune_gen(rtl r);
 int rtl_reset_buffer(rtl r);
 uint32_t rtl_get_center_freq(rtl r);
 int rtl_set_center_freq(rtl r, uint32_t center_freq);
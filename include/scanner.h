@@ -4,8 +4,9 @@
 #include "demod.h"
 #include "rtl.h"
 
+// SCANNER_WIDE finds every station from a few wideband captures
 typedef enum { SCANNER_OFF, SCANNER_ON, SCANNER_SEEK_UP,
-	       SCANNER_SEEK_DOWN } scanner_mode;
+	       SCANNER_SEEK_DOWN, SCANNER_WIDE } scanner_mode;
 
 typedef struct scanner_s * scanner;
 
@@ -13,7 +14,14 @@ scanner scanner_create();
 void scanner_destroy(scanner scan);
 void scanner_execute(scanner scan, demod dem, rtl r);
 
+// hold around retuning from anywhere else
+void scanner_lock_tuning(scanner scan);
+void scanner_unlock_tuning(scanner scan);
+
+void scanner_set_stations_path(scanner scan, const char * path);
+
 int scanner_get_last_station_found(scanner scan);
+int scanner_get_stations(scanner scan, demod_mode mode, int * stations, int len);
 
 scanner_mode scanner_get_mode(scanner scan);
 void scanner_set_mode(scanner scan, scanner_mode mode);
@@ -0,0 +1,44 @@
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * Sequence lock for small parameter structs that are read far more often
+ * than they're written. Readers copy the struct without taking any lock and
+ * retry if a write overlapped the copy:
+ *
+ *   do { seq = seqlock_read_begin(sl); copy = shared; }
+ *   while (seqlock_read_retry(sl, seq));
+ *
+ * Writers are serialized by a mutex, and readers only have to retry while a
+ * writer is actually storing (between publish_begin and publish_end).
+ */
+
+struct seqlock_s
+{
+  atomic_uint seq; // odd while a write is in progress
+  pthread_mutex_t write_m;
+};
+
+void seqlock_init(struct seqlock_s * sl);
+void seqlock_destroy(struct seqlock_s * sl);
+
+unsigned int seqlock_read_begin(struct seqlock_s * sl);
+bool seqlock_read_retry(struct seqlock_s * sl, unsigned int seq);
+
+// excludes other writers, e.g. around a read-modify-write
+void seqlock_lock(struct seqlock_s * sl);
+void seqlock_unlock(struct seqlock_s * sl);
+
+// bracket the stores themselves, with the lock held
+void seqlock_publish_begin(struct seqlock_s * sl);
+void seqlock_publish_end(struct seqlock_s * sl);
+
+// lock then publish_begin, and publish_end then unlock, for plain stores
+void seqlock_write_begin(struct seqlock_s * sl);
+void seqlock_write_end(struct seqlock_s * sl);
+
+#endif
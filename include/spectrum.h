@@ -0,0 +1,41 @@
+#ifndef __SPECTRUM_H__
+#define __SPECTRUM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Welch power spectrum estimator over raw RTL samples. One thread feeds it
+ * with spectrum_execute; the results (SNR, noise floor, per-bin power) can be
+ * read from any thread without locking.
+ */
+
+typedef enum { SPECTRUM_WINDOW_RECT, SPECTRUM_WINDOW_HANN,
+	       SPECTRUM_WINDOW_HAMMING, SPECTRUM_WINDOW_BLACKMAN_HARRIS }
+  spectrum_window;
+
+typedef struct spectrum_s * spectrum;
+
+spectrum spectrum_create(unsigned int nfft,
+			 unsigned int num_segments,
+			 spectrum_window window);
+void spectrum_destroy(spectrum sp);
+
+bool spectrum_execute(spectrum sp, const uint8_t * x, unsigned int n, float fs);
+void spectrum_reset(spectrum sp);
+
+void spectrum_set_cadence(spectrum sp, unsigned int cadence);
+void spectrum_set_step(spectrum sp, unsigned int step);
+void spectrum_set_signal_bandwidth(spectrum sp, float bw);
+
+unsigned int spectrum_get_size(spectrum sp);
+float spectrum_get_snr(spectrum sp);
+unsigned int spectrum_get_snr_stats(spectrum sp, float * mean, float * deviation);
+unsigned int spectrum_get_power(spectrum sp, float * power, unsigned int n,
+				unsigned int * gen);
+
+// n bins (dB) down to m, scaled from min_db..max_db to 0..255
+void spectrum_quantize(const float * power, unsigned int n, uint8_t * y,
+		       unsigned int m, float min_db, float max_db);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __STATIONCACHE_H__
+#define __STATIONCACHE_H__
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "demod.h"
+
+/**
+ * Stations found so far, per demod mode and sorted by frequency, with the
+ * SNR they were last heard at and when. Kept in a small file between runs so
+ * seeking can go straight to known stations. Safe to use from any thread.
+ *
+ * The file is little-endian: "RLSC", a version byte and three reserved ones,
+ * a uint32 count, then per station a uint8 mode, three reserved bytes, the
+ * frequency (uint32 Hz), SNR (float32 dB) and when (uint32 Unix time).
+ */
+
+typedef struct stationcache_s * stationcache;
+
+stationcache stationcache_create();
+void stationcache_destroy(stationcache sc);
+
+bool stationcache_load(stationcache sc, const char * path);
+bool stationcache_save(stationcache sc, const char * path);
+bool stationcache_is_dirty(stationcache sc);
+
+// heard at fc with the given SNR (or not, then it's forgotten)
+void stationcache_update(stationcache sc, demod_mode mode, int fc, float snr,
+			 bool present);
+
+// frequencies (Hz), up to len of them, returns the number copied
+int stationcache_get(stationcache sc, demod_mode mode, int * fcs, int len);
+
+// whether there's a station known at exactly fc
+bool stationcache_contains(stationcache sc, demod_mode mode, int fc);
+
+// nearest known station above (direction > 0) or below fc, wrapping around
+// the band (wrapped says so), -1 if there's none other than fc
+int stationcache_find_next(stationcache sc, demod_mode mode, int fc,
+			   int direction, bool * wrapped);
+
+#endif
@@ -2,18 +2,159 @@
 #define __WEBSOCKET_H__
 
 #include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
-typedef void (* websocket_receive_callback)(void * buf, size_t len, void * ctx);
+#include "codec.h"
+
+/**
+ * Every message is a binary frame starting with a websocket_header_s, then
+ * a fixed header for its type and whatever follows it. Fields are
+ * little-endian. The version only changes when an existing layout does; new
+ * message types can be added (and should be ignored by clients that don't
+ * know them).
+ */
+
+#define WEBSOCKET_PROTOCOL_VERSION 1
+
+typedef enum {
+  WEBSOCKET_MSG_AUDIO = 1, // websocket_audio_s, then the encoded audio
+  WEBSOCKET_MSG_TELEMETRY = 2, // websocket_telemetry_s, sent when it changes
+  WEBSOCKET_MSG_SPECTRUM = 3, // websocket_spectrum_s, then a byte per bin
+  WEBSOCKET_MSG_CHANNELS = 4, // websocket_channels_s, then the channels
+  WEBSOCKET_MSG_STATIONS = 5 // websocket_stations_s, then uint32 Hz each
+} websocket_msg_type;
+
+struct websocket_header_s
+{
+  uint8_t version;
+  uint8_t type;
+  uint16_t reserved;
+} __attribute__ ((packed));
+
+#define WEBSOCKET_AUDIO_SILENT 0x01 /* no audio, just how many samples */
+
+struct websocket_audio_s
+{
+  struct websocket_header_s header;
+  uint32_t seq; // of the demod block, gaps are blocks missed
+  uint32_t num_samples; // after decimation
+  uint8_t format; // codec_get_format
+  uint8_t flags;
+  uint16_t reserved;
+  uint64_t time; // when it was demodulated, us since the epoch
+} __attribute__ ((packed));
+
+struct websocket_telemetry_s
+{
+  struct websocket_header_s header;
+  uint32_t fc; // Hz, as the tuner's set
+  uint32_t fs; // S/s
+  float snr; // dB
+  float throughput; // S/s
+  int32_t last_station_found; // Hz, -1 if none
+  uint32_t overruns;
+  uint32_t underruns;
+  uint32_t skipped; // demod blocks the sender fell behind on
+  uint32_t drops; // frames dropped over every client
+  uint16_t clients;
+  uint8_t mode; // demod_mode
+  uint8_t scanner_mode; // scanner_mode
+} __attribute__ ((packed));
+
+struct websocket_spectrum_s
+{
+  struct websocket_header_s header;
+  uint32_t fc;
+  uint32_t fs;
+  float min_db; // bins are 0 to 255 over min_db to max_db
+  float max_db;
+  uint16_t num_bins;
+  uint16_t reserved;
+} __attribute__ ((packed));
+
+struct websocket_channel_s
+{
+  uint32_t fc;
+  float power; // dB
+} __attribute__ ((packed));
+
+struct websocket_channels_s
+{
+  struct websocket_header_s header;
+  uint16_t num_channels;
+  uint16_t reserved;
+} __attribute__ ((packed));
+
+struct websocket_stations_s
+{
+  struct websocket_header_s header;
+  uint8_t mode; // demod_mode
+  uint8_t reserved;
+  uint16_t num_stations;
+} __attribute__ ((packed));
+
+// every client's owed the latest message of each of these kinds, however far
+// behind its audio is (see websocket_send_state; spectrum frames are sent by
+// websocket_send_spectrum)
+typedef enum {
+  WEBSOCKET_SLOT_TELEMETRY,
+  WEBSOCKET_SLOT_CHANNELS,
+  WEBSOCKET_SLOT_FM_STATIONS,
+  WEBSOCKET_SLOT_AM_STATIONS,
+  WEBSOCKET_SLOT_SPECTRUM,
+  WEBSOCKET_NUM_SLOTS
+} websocket_slot;
+
+// client identifies which connection a command came from
+typedef void (* websocket_receive_callback)(void * buf,
+					    size_t len,
+					    int client,
+					    void * ctx);
+typedef void (* websocket_release_callback)(void * arg, void * ctx);
 typedef struct websocket_s * websocket;
 
 websocket websocket_create();
 void websocket_destroy(websocket ws);
 void websocket_execute(websocket ws, websocket_receive_callback cb, void * ctx);
 
-void websocket_send(websocket ws,
-		    void * header,
-		    size_t header_size,
-		    void * data,
-		    size_t data_size);
+size_t websocket_get_headroom();
+size_t websocket_get_tailroom();
+void websocket_set_release_callback(websocket ws,
+				    websocket_release_callback cb,
+				    void * ctx);
+
+void websocket_send_audio(websocket ws,
+			  uint32_t seq,
+			  const struct timespec * time,
+			  int16_t * data,
+			  unsigned int n,
+			  void * arg);
+void websocket_send_silence(websocket ws,
+			    uint32_t seq,
+			    const struct timespec * time,
+			    unsigned int n);
+void websocket_send_state(websocket ws,
+			  websocket_slot slot,
+			  const void * msg,
+			  size_t size);
+
+bool websocket_wants_spectrum(websocket ws);
+bool websocket_is_spectrum_due(websocket ws);
+void websocket_send_spectrum(websocket ws,
+			     uint32_t fc,
+			     uint32_t fs,
+			     const float * power,
+			     unsigned int n);
+
+int websocket_get_num_clients(websocket ws);
+unsigned int websocket_get_connections(websocket ws);
+unsigned int websocket_get_drops(websocket ws);
+
+void websocket_set_client_codec(websocket ws, int client, codec_type type);
+void websocket_set_client_decim(websocket ws, int client, unsigned int decim);
+void websocket_set_client_spectrum(websocket ws, int client, unsigned int bins,
+				   float rate);
 
 #endif
@@ -38,7 +38,7 @@ function(Client, FrequencyTuner, React, Bs) {
     
     onScan: function(e) {
       if (this.props.disabled) return;
-      Client.setScan('on');
+      Client.setScan('wide');
     },
 
     onSeekDown: function(e) {
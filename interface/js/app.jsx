@@ -1,8 +1,9 @@
 /** @jsx React.DOM */
 
-define(['jsx!client', 'jsx!connector', 'jsx!modulations', 'react'],
+define(['jsx!client', 'jsx!connector', 'jsx!modulations', 'jsx!waterfall',
+	'react'],
 
-function(Client, Connector, Modulations, React) {
+function(Client, Connector, Modulations, Waterfall, React) {
   var AudioContext = AudioContext || webkitAudioContext;
   
   return {
@@ -14,6 +15,7 @@ function(Client, Connector, Modulations, React) {
     // view components
     connector: null,
     modulations: null,
+    waterfall: null,
     
     // config
     bufferSize: Math.pow(2,11),
@@ -24,6 +26,36 @@ function(Client, Connector, Modulations, React) {
     buffers: [],
     cursor: 0,
     semaphore: 0,
+    last: 0, // last sample, for interpolating decimated audio
+    heartbeat: { stations: {}, channels: [] }, // telemetry, merged as it comes
+
+    // messages (see websocket.h)
+    VERSION: 1,
+    AUDIO: 1,
+    TELEMETRY: 2,
+    SPECTRUM: 3,
+    CHANNELS: 4,
+    STATIONS: 5,
+    SILENT: 0x01,
+
+    modes: ['none', 'fm', 'am'],
+
+    // codecs (see codec.h)
+    PCM16: 0,
+    ULAW: 1,
+    ALAW: 2,
+    ADPCM: 3,
+
+    adpcmIndex: [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8],
+    adpcmSteps: [
+      7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+      45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+      209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+      876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+      2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845,
+      8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+      22385, 24623, 27086, 29794, 32767
+    ],
     
     init: function() {
       var self = this;
@@ -61,39 +93,178 @@ function(Client, Connector, Modulations, React) {
       
       React.renderComponent(this.modulations,
 			    document.getElementById('modulations'));
+
+      this.waterfall = <Waterfall />;
+
+      React.renderComponent(this.waterfall,
+			    document.getElementById('waterfall'));
+    },
+
+    ulaw: function(u) {
+      u = ~u & 0xff;
+      var t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+      return (u & 0x80) ? 0x84 - t : t - 0x84;
+    },
+
+    alaw: function(a) {
+      a ^= 0x55;
+      var t = (a & 0x0f) << 4,
+          seg = (a & 0x70) >> 4;
+
+      if (seg == 0) { t += 8; }
+      else { t = (t + 0x108) << Math.max(seg - 1, 0); }
+
+      return (a & 0x80) ? t : -t;
+    },
+
+    // the samples (as int16 values) in a message's audio
+    decode: function(view, offset, codec) {
+      var n = view.byteLength - offset,
+          samples, i;
+
+      switch (codec) {
+      case this.ULAW:
+      case this.ALAW:
+	samples = new Float32Array(n);
+	for (i = 0; i < n; i++) {
+	  var b = view.getUint8(offset + i);
+	  samples[i] = codec == this.ULAW ? this.ulaw(b) : this.alaw(b);
+	}
+	break;
+
+      case this.ADPCM:
+	// every message starts from the encoder's state
+	var predictor = view.getInt16(offset, true),
+	    index = view.getUint8(offset + 2);
+
+	samples = new Float32Array(2*(n - 4) - view.getUint8(offset + 3));
+
+	for (i = 0; i < samples.length; i++) {
+	  var code = (view.getUint8(offset + 4 + (i >> 1)) >> ((i & 1) * 4)) & 0x0f,
+	      step = this.adpcmSteps[index],
+	      delta = step >> 3;
+
+	  if (code & 4) { delta += step; }
+	  if (code & 2) { delta += step >> 1; }
+	  if (code & 1) { delta += step >> 2; }
+
+	  predictor += code & 8 ? -delta : delta;
+	  predictor = Math.max(-32768, Math.min(32767, predictor));
+	  index = Math.max(0, Math.min(88, index + this.adpcmIndex[code]));
+
+	  samples[i] = predictor;
+	}
+	break;
+
+      default:
+	samples = new Float32Array(n >> 1);
+	for (i = 0; i < samples.length; i++) {
+	  samples[i] = view.getInt16(offset + 2*i, true); }
+	break;
+      }
+
+      return samples;
     },
 
     onMessage: function(e) {
-      var view = new DataView(e.data),
-          littleEndian = true,
-          headerSize = view.getUint32(0, littleEndian),
-          header = [];
+      var view = new DataView(e.data);
 
-      // the current offset
-      var offset = 4;
+      if (view.getUint8(0) != this.VERSION) {
+	console.log('unknown protocol version ' + view.getUint8(0));
+	return;
+      }
 
-      if (headerSize > 0) {
-	for (var i = 0; i < headerSize; i++) {
-	  header.push(view.getUint8(offset + i)); }
+      switch (view.getUint8(1)) {
+      case this.AUDIO: this.onAudio(view); break;
+      case this.TELEMETRY: this.onTelemetry(view); break;
+      case this.SPECTRUM: this.onSpectrum(view); break;
+      case this.CHANNELS: this.onChannels(view); break;
+      case this.STATIONS: this.onStations(view); break;
+      default: break; // newer than us
+      }
+    },
 
-	offset += headerSize;
-	
-	// convert to string, parse
-	header = JSON.parse(String.fromCharCode.apply(null, header));
+    // should've made the heartbeat info global somehow, instead of passing it
+    // downward like this
+    updateHeartbeat: function() {
+      this.modulations.setState({ heartbeat: this.heartbeat });
+    },
 
-	// do something
-	// console.log(header);
+    onTelemetry: function(view) {
+      var h = this.heartbeat,
+          smode = view.getUint8(43);
 
-	// should've made the heartbeat info global somehow, instead of passing it
-	// downward like this
-	this.modulations.setState({ heartbeat: header });
+      h.fc = view.getUint32(4, true);
+      h.fs = view.getUint32(8, true);
+      h.snr = view.getFloat32(12, true);
+      h.throughput = view.getFloat32(16, true);
+      h.lastStationFound = view.getInt32(20, true);
+      h.overruns = view.getUint32(24, true);
+      h.underruns = view.getUint32(28, true);
+      h.skipped = view.getUint32(32, true);
+      h.drops = view.getUint32(36, true);
+      h.clients = view.getUint16(40, true);
+      h.mode = this.modes[view.getUint8(42)];
+
+      // see scanner.h
+      h.scanning = smode == 1 || smode == 4;
+      h.seeking = smode == 2 || smode == 3;
+
+      this.updateHeartbeat();
+    },
+
+    onChannels: function(view) {
+      var n = view.getUint16(4, true),
+          channels = [];
+
+      for (var i = 0, offset = 8; i < n; i++, offset += 8) {
+	channels.push([view.getUint32(offset, true),
+		       view.getFloat32(offset + 4, true)]);
       }
 
-      var dataSize = Math.floor((e.data.byteLength - offset) / 2),
+      this.heartbeat.channels = channels;
+      this.updateHeartbeat();
+    },
+
+    onStations: function(view) {
+      var n = view.getUint16(6, true),
+          stations = [];
+
+      for (var i = 0; i < n; i++) {
+	stations.push(view.getUint32(8 + 4*i, true)); }
+
+      this.heartbeat.stations[this.modes[view.getUint8(4)]] = stations;
+      this.updateHeartbeat();
+    },
+
+    // a byte per bin
+    onSpectrum: function(view) {
+      var header = {
+	fc: view.getUint32(4, true),
+	fs: view.getUint32(8, true),
+	min: view.getFloat32(12, true),
+	max: view.getFloat32(16, true)
+      };
+
+      this.waterfall.push(header, new Uint8Array(view.buffer, 24,
+						 view.getUint16(20, true)));
+    },
+
+    onAudio: function(view) {
+      var offset = 24,
+          numSamples = view.getUint32(8, true),
+          format = view.getUint8(12),
+          silent = (view.getUint8(13) & this.SILENT) != 0,
+          codec = format & 0x07,
+          decim = (format >> 3) + 1;
+
+      // when squelched there's just the number of samples of silence
+      var samples = silent ? new Float32Array(numSamples)
+                           : this.decode(view, offset, codec),
           nf = 32767.0,
           buf = this.buffers[this.buffers.length - 1];
       
-      for (var i = 0; i < dataSize; i++) {
+      for (var i = 0; i < samples.length * decim; i++) {
 	if (buf == null || this.cursor >= this.bufferSize) {
 	  buf = new Float32Array(this.bufferSize);
 	  this.buffers.push(buf);
@@ -101,9 +272,15 @@ function(Client, Connector, Modulations, React) {
 	  this.semaphore++;
 	}
 
-	// read next sample into buffer
-	buf[this.cursor++] = view.getInt16(offset + 2*i, littleEndian) / nf;
+	// read next sample into buffer, interpolating back up to the full rate
+	var k = Math.floor(i / decim),
+	    frac = (i % decim + 1) / decim,
+	    prev = k > 0 ? samples[k - 1] : this.last;
+
+	buf[this.cursor++] = (prev + (samples[k] - prev) * frac) / nf;
       }
+
+      if (samples.length > 0) { this.last = samples[samples.length - 1]; }
     }
   };
 }
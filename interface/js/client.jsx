@@ -31,12 +31,30 @@ define(function() {
 
     setMode: function(mode) { this.send('-m ' + mode); },
 
-    // 'on' or 'off'
+    // 'on', 'off', 'up', 'down' or 'wide' (every station in one sweep)
     setScan: function(state) { this.send('-s ' + state); },
 
     // 'up' or 'down'
     setSeek: function(state) { this.send('-s ' + state); },
+
+    // 'on' or 'off', power in every FM channel of the capture (see onChannels)
+    setChannelMonitor: function(state) { this.send('-c ' + state); },
+
+    // play the monitored channel at fc (Hz) instead of the tuned station,
+    // without retuning (0 goes back to it)
+    listenChannel: function(fc) { this.send('-l ' + Math.floor(fc)); },
     
+    // 'pcm16', 'ulaw', 'alaw' or 'adpcm', for this connection only
+    setEncoding: function(codec) { this.send('-e ' + codec); },
+
+    // audio rate (Hz) for this connection, the server picks the closest at or
+    // above it
+    setAudioRate: function(rate) { this.send('-o ' + rate); },
+
+    // spectrum frames for this connection, bins wide, rate a second (0 stops
+    // them)
+    setSpectrum: function(bins, rate) { this.send('-w ' + rate + ' -b ' + bins); },
+
     setSampleRate: function(fs, ord) {
       fs = typeof fs == 'string' ? parseFloat(fs) * (ord || 1e6) : fs;
       fs = Math.floor(fs);
@@ -37,12 +37,11 @@ function(Am, Client, Fm, Settings, React, Bs) {
       var self = this,
           mode = this.state.mode,
           heartbeat = this.state.heartbeat,
-          recordStations = heartbeat.scanning || heartbeat.seeking,
-          lastStation = heartbeat.lastStationFound,
           stations = this.props.stations;
 
-      if (recordStations && lastStation > 0 && stations[mode].indexOf(lastStation) == -1) {
-	stations[mode].push(lastStation);
+      // the server's station cache (which outlives this page) is the list
+      if (heartbeat.stations && heartbeat.stations[mode]) {
+	stations[mode] = heartbeat.stations[mode];
       }
       
       var views = {
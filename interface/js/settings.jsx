@@ -11,9 +11,44 @@ define(['jsx!client', 'react'], function(Client, React) {
     
     getInitialState: function() {
       return {
-	sampleRate: this.props.heartbeat.fs
+	sampleRate: this.props.heartbeat.fs,
+	encoding: 'pcm16',
+	audioRate: 48000,
+	spectrumRate: 0,
+	spectrumBins: 256
       };
     },
+
+    onChangeSpectrumRate: function(e) {
+      if (this.props.disabled) return;
+
+      var rate = parseInt(e.target.value);
+      Client.setSpectrum(this.state.spectrumBins, rate);
+      this.setState({ spectrumRate: rate });
+    },
+
+    onChangeSpectrumBins: function(e) {
+      if (this.props.disabled) return;
+
+      var bins = parseInt(e.target.value);
+      if (this.state.spectrumRate > 0) { Client.setSpectrum(bins, this.state.spectrumRate); }
+      this.setState({ spectrumBins: bins });
+    },
+
+    onChangeEncoding: function(e) {
+      if (this.props.disabled) return;
+
+      Client.setEncoding(e.target.value);
+      this.setState({ encoding: e.target.value });
+    },
+
+    onChangeAudioRate: function(e) {
+      if (this.props.disabled) return;
+
+      var rate = parseInt(e.target.value);
+      Client.setAudioRate(rate);
+      this.setState({ audioRate: rate });
+    },
       
     onChangeSampleRate: function(e) {
       if (this.props.disabled) return;
@@ -55,6 +90,55 @@ define(['jsx!client', 'react'], function(Client, React) {
 	      </select>
 	      </div>
 	    </div>
+	    <div className="form-group">
+	      <label className="col-sm-2 control-label">Audio Encoding</label>
+	      <div className="col-sm-10">
+	      <select className="form-control" value={this.state.encoding}
+	        onChange={this.onChangeEncoding}>
+	        <option value="pcm16">16-bit PCM</option>
+	        <option value="ulaw">&mu;-law</option>
+	        <option value="alaw">A-law</option>
+	        <option value="adpcm">IMA ADPCM</option>
+	      </select>
+	      </div>
+	    </div>
+	    <div className="form-group">
+	      <label className="col-sm-2 control-label">Audio Rate</label>
+	      <div className="col-sm-10">
+	      <select className="form-control" value={this.state.audioRate}
+	        onChange={this.onChangeAudioRate}>
+	        <option value="48000">48 kHz</option>
+	        <option value="24000">24 kHz</option>
+	        <option value="16000">16 kHz</option>
+	        <option value="12000">12 kHz</option>
+	        <option value="8000">8 kHz</option>
+	      </select>
+	      </div>
+	    </div>
+	    <div className="form-group">
+	      <label className="col-sm-2 control-label">Spectrum</label>
+	      <div className="col-sm-10">
+	      <select className="form-control" value={this.state.spectrumRate}
+	        onChange={this.onChangeSpectrumRate}>
+	        <option value="0">Off</option>
+	        <option value="5">5 frames/s</option>
+	        <option value="10">10 frames/s</option>
+	        <option value="20">20 frames/s</option>
+	      </select>
+	      </div>
+	    </div>
+	    <div className="form-group">
+	      <label className="col-sm-2 control-label">Spectrum Resolution</label>
+	      <div className="col-sm-10">
+	      <select className="form-control" value={this.state.spectrumBins}
+	        onChange={this.onChangeSpectrumBins}>
+	        <option value="128">128 bins</option>
+	        <option value="256">256 bins</option>
+	        <option value="512">512 bins</option>
+	        <option value="1024">1024 bins</option>
+	      </select>
+	      </div>
+	    </div>
           </form>
         </div>
       </fieldset>
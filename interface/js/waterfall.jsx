@@ -0,0 +1,63 @@
+/** @jsx React.DOM */
+
+define(['react'], function(React) {
+  return React.createClass({
+    getDefaultProps: function() {
+      return {
+	height: 200
+      };
+    },
+
+    getInitialState: function() {
+      return {
+	fc: 0,
+	fs: 0
+      };
+    },
+
+    // newest line on top, a dB value (0 to 255 over min to max) per bin
+    push: function(header, bins) {
+      var canvas = this.refs.canvas.getDOMNode(),
+          ctx = canvas.getContext('2d'),
+          width = canvas.width,
+          height = canvas.height,
+          line = ctx.createImageData(width, 1);
+
+      for (var x = 0; x < width; x++) {
+	var v = bins[Math.floor(x * bins.length / width)];
+
+	// dark blue through yellow
+	line.data[4*x] = Math.min(255, 2*v);
+	line.data[4*x+1] = Math.max(0, 2*v - 255);
+	line.data[4*x+2] = Math.max(0, 128 - v);
+	line.data[4*x+3] = 255;
+      }
+
+      ctx.drawImage(canvas, 0, 0, width, height - 1, 0, 1, width, height - 1);
+      ctx.putImageData(line, 0, 0);
+
+      if (header.fc != this.state.fc || header.fs != this.state.fs) {
+	this.setState({ fc: header.fc, fs: header.fs });
+      }
+    },
+
+    render: function() {
+      var fc = this.state.fc,
+          fs = this.state.fs,
+          mhz = function(f) { return Math.floor(f / 1e4) / 100; };
+
+      return (
+      <div className="row">
+	<div className="col-md-12">
+	  <canvas ref="canvas" width="1024" height={this.props.height}
+	    style={{width: '100%', height: this.props.height + 'px'}} />
+	  <div style={{display: fs ? 'block' : 'none'}}>
+	    <span>{mhz(fc - fs/2)} MHz</span>
+	    <span style={{float: 'right'}}>{mhz(fc + fs/2)} MHz</span>
+	  </div>
+	</div>
+      </div>
+      );
+    }
+  });
+});
@@ -1,11 +1,17 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <stdint.h>
 
+#include "config.h"
 #include "controller.h"
+#include "convert.h"
 #include "demod.h"
+#include "filtercache.h"
 #include "macros.h"
 #include "rtl.h"
 #include "scanner.h"
@@ -19,8 +25,137 @@ static void sighandler(int signum)
   exiting = true;
 }
 
-int main()
+static void usage(char * name)
 {
+  ERROR("Usage: %s [-i recording] [-n] [-x] [-k] [-F filters] [-p cpus]\n"
+	"       [-t stations]\n"
+	"  -i  replay 8-bit IQ from a file (rtl_sdr .bin or SigMF cu8)\n"
+	"      instead of opening a device\n"
+	"  -n  don't pace the replay to its sample rate, run flat out\n"
+	"  -x  demodulate in fixed point (faster without a hardware FPU)\n"
+	"  -k  keep the filters' state across retunes, for seamless (but\n"
+	"      briefly mixed) audio instead of a clean cut\n"
+	"  -F  first decimation filter for FM and AM, time (CIC and\n"
+	"      half-band), fft (overlap-save) or auto (whichever is estimated\n"
+	"      to be cheaper), e.g. fft or fft,time (default auto)\n"
+	"  -p  pin the demod's front end, detector, audio, metrics and channel\n"
+	"      monitor threads to these CPUs, e.g. 1,2,3,0,0 (-1 leaves a\n"
+	"      thread unpinned)\n"
+	"  -t  keep the stations found in this file (default "
+	STATIONCACHE_PATH ")\n",
+	name);
+}
+
+/**
+ * Parses a comma-separated list of up to DEMOD_NUM_STAGES CPU numbers into
+ * cpus, returns false if it's malformed.
+ */
+static bool parse_cpus(char * s, int * cpus)
+{
+  char * end;
+  int i;
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) {
+    cpus[i] = (int) strtol(s, & end, 10);
+
+    if (end == s) { return false; }
+    if (* end == '\0') { return true; }
+    if (* end != ',') { return false; }
+
+    s = end + 1;
+  }
+
+  return false;
+}
+
+static bool parse_filter(char * s, char ** end, demod_filter * filter)
+{
+  static const char * names[] = {
+    [DEMOD_FILTER_AUTO] = "auto",
+    [DEMOD_FILTER_TIME] = "time",
+    [DEMOD_FILTER_FFT] = "fft"
+  };
+  size_t len;
+  int i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    len = strlen(names[i]);
+
+    if (strncmp(s, names[i], len) == 0 && (s[len] == '\0' || s[len] == ',')) {
+      * filter = (demod_filter) i;
+      * end = s + len;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Parses one filter for both modes, or a comma-separated FM and AM pair,
+ * returns false if it's malformed.
+ */
+static bool parse_filters(char * s, demod_filter * fm, demod_filter * am)
+{
+  char * end;
+
+  if ( ! parse_filter(s, & end, fm)) { return false; }
+
+  if (* end == '\0') {
+    * am = * fm;
+    return true;
+  }
+
+  return parse_filter(end + 1, & end, am) && * end == '\0';
+}
+
+int main(int argc, char ** argv)
+{
+  char * replay_path = NULL;
+  char * stations_path = STATIONCACHE_PATH;
+  bool replay_paced = true;
+  bool fixed_point = DEMOD_FIXED_POINT;
+  bool reset_on_retune = true;
+  demod_filter fm_filter = DEMOD_FILTER_AUTO;
+  demod_filter am_filter = DEMOD_FILTER_AUTO;
+  int cpus[DEMOD_NUM_STAGES] = { -1, -1, -1, -1, -1 };
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "i:nxkF:p:t:")) != -1) {
+    switch (opt) {
+    case 'i':
+      replay_path = optarg;
+      break;
+    case 'n':
+      replay_paced = false;
+      break;
+    case 'x':
+      fixed_point = true;
+      break;
+    case 'k':
+      reset_on_retune = false;
+      break;
+    case 'F':
+      if ( ! parse_filters(optarg, & fm_filter, & am_filter)) {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    case 't':
+      stations_path = optarg;
+      break;
+    case 'p':
+      if ( ! parse_cpus(optarg, cpus)) {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
   // initialize signal handler
   struct sigaction sigact;
 
@@ -32,11 +167,24 @@ int main()
   sigaction(SIGQUIT, & sigact, NULL);
   sigaction(SIGPIPE, & sigact, NULL);
   
+  // pick the fastest sample conversion kernels for this CPU
+  convert_init();
+  DEBUG("Using %s sample conversion.\n", convert_get_name());
+
   // initialize components
   controller ctrl;
   demod dem = demod_create();
-  rtl r = rtl_create(-1);
+  demod_set_fixed_point(dem, fixed_point);
+  demod_set_reset_on_retune(dem, reset_on_retune);
+  demod_set_filter(dem, DEMOD_FM, fm_filter);
+  demod_set_filter(dem, DEMOD_AM, am_filter);
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) {
+    demod_set_stage_cpu(dem, (demod_stage) i, cpus[i]); }
+  rtl r = replay_path != NULL ? rtl_create_replay(replay_path, replay_paced)
+                              : rtl_create(-1);
   scanner scan = scanner_create();
+  scanner_set_stations_path(scan, stations_path);
   websocket ws = websocket_create();
 
   ctrl = controller_create(dem, r, scan, ws);
@@ -45,11 +193,14 @@ int main()
   while ( ! exiting) { controller_execute(ctrl); }
   
   demod_exit(dem);
+
+  // the websocket may still be holding demod output
+  websocket_destroy(ws);
     
   // TODO make the order arbitrary (at the moment demod must be destroyed
   // before the RTL, otherwise it hangs)
   demod_destroy(dem);
-  websocket_destroy(ws);
+  filtercache_clear();
   rtl_destroy(r);
   scanner_destroy(scan);
   controller_destroy(ctrl);
@@ -0,0 +1,349 @@
+#include <complex.h>
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channelizer.h"
+#include "convert.h"
+#include "detect.h"
+#include "macros.h"
+#include "rtl.h"
+
+#define CHANNELIZER_FILTER_DELAY 7 /* filterbank prototype semi-length */
+#define CHANNELIZER_AS 60.0f /* stopband attenuation (dB) */
+
+struct channelizer_channel_s
+{
+  bool enabled;
+
+  // the channel's filterbank output over the last block (only kept while
+  // it's enabled, allocated the first time it is)
+  float complex * y;
+
+  // FM detector state and audio resampler
+  float complex prev;
+  resamp_rrrf resamp;
+
+  // power summed over the last block, then its mean (dB relative to full
+  // scale)
+  float sum;
+  float power;
+
+  // audio from the last block
+  int16_t * output;
+  int output_len;
+};
+
+struct channelizer_s
+{
+  int input_rate;
+  int spacing;
+  int output_rate;
+
+  // number of channels, the filterbank runs at num_channels * spacing
+  int num_channels;
+
+  // only needed if the input rate isn't a multiple of the spacing
+  msresamp_crcf resamp;
+  float r;
+
+  firpfbch_crcf bank;
+
+  // converted input; starts with samples left over from the last block
+  float complex * x;
+  float complex * tmp;
+  unsigned int carry;
+
+  // one filterbank output, a sample per channel, and the most there can be
+  // from a block
+  float complex * frame;
+  unsigned int t_cap;
+
+  // scratch for one channel's discriminator and resampler output
+  float * d;
+  float * a;
+  unsigned int a_cap;
+
+  struct channelizer_channel_s * channels;
+
+  // whether the powers have been measured since the last reset
+  bool measured;
+};
+
+channelizer channelizer_create(int input_rate, int spacing, int output_rate)
+{
+  channelizer ch = (channelizer) malloc(sizeof(struct channelizer_s));
+
+  unsigned int nx = RTL_MAX_BUFFER_LENGTH / 2;
+  int k;
+
+  ch->input_rate = input_rate;
+  ch->spacing = spacing;
+  ch->output_rate = output_rate;
+  ch->num_channels = input_rate / spacing;
+
+  if (ch->num_channels < 1) { ch->num_channels = 1; }
+
+  // bring the rate down onto the grid first if need be
+  ch->r = ((float) ch->num_channels * spacing) / ((float) input_rate);
+  ch->resamp = input_rate % spacing != 0 ?
+    msresamp_crcf_create(ch->r, CHANNELIZER_AS) : NULL;
+
+  ch->bank = firpfbch_crcf_create_kaiser(LIQUID_ANALYZER, ch->num_channels,
+					 CHANNELIZER_FILTER_DELAY,
+					 CHANNELIZER_AS);
+
+  ch->x = (float complex *) malloc((nx + ch->num_channels + 2) *
+				   sizeof(float complex));
+  ch->tmp = ch->resamp != NULL ?
+    (float complex *) malloc(nx * sizeof(float complex)) : NULL;
+  ch->carry = 0;
+
+  ch->t_cap = (nx + ch->num_channels + 2) / ch->num_channels + 1;
+  ch->frame = (float complex *) malloc(ch->num_channels *
+				       sizeof(float complex));
+
+  ch->a_cap = (unsigned int) ceilf(ch->t_cap * ((float) output_rate) /
+				   ((float) spacing)) + 2;
+  ch->d = (float *) malloc(ch->t_cap * sizeof(float));
+  ch->a = (float *) malloc(ch->a_cap * sizeof(float));
+
+  ch->channels = (struct channelizer_channel_s *)
+    malloc(ch->num_channels * sizeof(struct channelizer_channel_s));
+
+  for (k = 0; k < ch->num_channels; k++) {
+    struct channelizer_channel_s * c = & ch->channels[k];
+
+    c->enabled = false;
+    c->y = NULL;
+    c->prev = 1.0f;
+    c->resamp = resamp_rrrf_create(((float) output_rate) / ((float) spacing),
+				   9, 20e3 / ((float) spacing),
+				   CHANNELIZER_AS, 16);
+    c->sum = 0.0f;
+    c->power = -100.0f;
+    c->output = (int16_t *) malloc(ch->a_cap * sizeof(int16_t));
+    c->output_len = 0;
+  }
+
+  ch->measured = false;
+
+  return ch;
+}
+
+void channelizer_destroy(channelizer ch)
+{
+  int k;
+
+  for (k = 0; k < ch->num_channels; k++) {
+    resamp_rrrf_destroy(ch->channels[k].resamp);
+    free(ch->channels[k].y);
+    free(ch->channels[k].output);
+  }
+
+  if (ch->resamp) { msresamp_crcf_destroy(ch->resamp); }
+  firpfbch_crcf_destroy(ch->bank);
+
+  free(ch->channels);
+  free(ch->x);
+  free(ch->tmp);
+  free(ch->frame);
+  free(ch->d);
+  free(ch->a);
+  free(ch);
+}
+
+/**
+ * Filterbank outputs are ordered DC first, then positive, then negative
+ * frequencies; our channel numbers go from lowest to highest.
+ */
+static int _channelizer_bank_index(channelizer ch, int k)
+{
+  return (k - ch->num_channels/2 + ch->num_channels) % ch->num_channels;
+}
+
+// clears a channel's detector and resampler, for when its samples stop
+// following on from the last ones
+static void _channelizer_channel_reset(struct channelizer_channel_s * c)
+{
+  c->prev = 1.0f;
+  resamp_rrrf_reset(c->resamp);
+  c->output_len = 0;
+}
+
+/**
+ * Takes a block of n interleaved unsigned 8-bit IQ samples. Every channel's
+ * power is measured, and the enabled ones are FM-demodulated.
+ */
+void channelizer_execute(channelizer ch, const uint8_t * x, unsigned int n)
+{
+  unsigned int M = (unsigned int) ch->num_channels;
+  unsigned int ny, total, T, t, i, na;
+  struct channelizer_channel_s * c;
+  float complex v;
+  int k;
+
+  // convert (and maybe resample) after whatever was left over last time
+  if (ch->resamp != NULL) {
+    convert_u8_to_cf(x, ch->tmp, n);
+    msresamp_crcf_execute(ch->resamp, ch->tmp, n, ch->x + ch->carry, & ny);
+  }
+  else {
+    convert_u8_to_cf(x, ch->x + ch->carry, n);
+    ny = n;
+  }
+
+  total = ch->carry + ny;
+  T = total / M;
+  if (T > ch->t_cap) { T = ch->t_cap; }
+
+  for (k = 0; k < (int) M; k++) { ch->channels[k].sum = 0.0f; }
+
+  // one output sample per channel for every M input samples, kept only for
+  // the channels being demodulated
+  for (t = 0; t < T; t++) {
+    firpfbch_crcf_analyzer_execute(ch->bank, ch->x + t*M, ch->frame);
+
+    for (k = 0; k < (int) M; k++) {
+      c = & ch->channels[k];
+      v = ch->frame[_channelizer_bank_index(ch, k)];
+
+      c->sum += crealf(v)*crealf(v) + cimagf(v)*cimagf(v);
+
+      if (c->enabled) { c->y[t] = v; }
+    }
+  }
+
+  ch->carry = total - T*M;
+  memmove(ch->x, ch->x + T*M, ch->carry * sizeof(float complex));
+
+  if (T == 0) { return; }
+
+  for (k = 0; k < (int) M; k++) {
+    c = & ch->channels[k];
+
+    // samples are in raw 8-bit units
+    c->power = 10.0f * log10f(c->sum / (T * 128.0f * 128.0f) + 1e-20f);
+
+    if ( ! c->enabled) { continue; }
+
+    // same scaling as the main FM demod (kf = 1)
+    detect_fm(c->y, T, & c->prev, 1.0f / (2.0f * M_PI), ch->d);
+
+    for (t = 0, na = 0; t < T && na + 2 < ch->a_cap; t++) {
+      resamp_rrrf_execute(c->resamp, ch->d[t], ch->a + na, & i);
+      na += i;
+    }
+
+    convert_f_to_s16(ch->a, c->output, na, 32768.0f);
+    c->output_len = (int) na;
+  }
+
+  ch->measured = true;
+}
+
+/**
+ * Forgets the filterbank's history, the powers measured and the enabled
+ * channels' detector state, for when the samples stop following on from
+ * the last block (e.g. after a retune).
+ */
+void channelizer_reset(channelizer ch)
+{
+  int k;
+
+  // nothing's been fed since the last reset
+  if ( ! ch->measured && ch->carry == 0) { return; }
+
+  if (ch->resamp) { msresamp_crcf_reset(ch->resamp); }
+  firpfbch_crcf_reset(ch->bank);
+
+  for (k = 0; k < ch->num_channels; k++) {
+    if (ch->channels[k].enabled) {
+      _channelizer_channel_reset( & ch->channels[k]); }
+  }
+
+  ch->carry = 0;
+  ch->measured = false;
+}
+
+int channelizer_get_input_rate(channelizer ch)
+{
+  return ch->input_rate;
+}
+
+int channelizer_get_output_rate(channelizer ch)
+{
+  return ch->output_rate;
+}
+
+int channelizer_get_num_channels(channelizer ch)
+{
+  return ch->num_channels;
+}
+
+/**
+ * Offset of channel k from the tuned frequency (Hz).
+ */
+int channelizer_get_offset(channelizer ch, int k)
+{
+  return (k - ch->num_channels/2) * ch->spacing;
+}
+
+/**
+ * Channel nearest to an offset from the tuned frequency, -1 if it's outside
+ * the captured band.
+ */
+int channelizer_lookup_channel(channelizer ch, int offset)
+{
+  int k = (int) lroundf(((float) offset) / ch->spacing) + ch->num_channels/2;
+  return k >= 0 && k < ch->num_channels ? k : -1;
+}
+
+bool channelizer_get_enabled(channelizer ch, int k)
+{
+  return ch->channels[k].enabled;
+}
+
+/**
+ * Starts or stops demodulating channel k, from the next block.
+ */
+void channelizer_set_enabled(channelizer ch, int k, bool enabled)
+{
+  struct channelizer_channel_s * c = & ch->channels[k];
+
+  if (enabled && ! c->enabled) {
+    if (c->y == NULL) {
+      c->y = (float complex *) malloc(ch->t_cap * sizeof(float complex)); }
+
+    _channelizer_channel_reset(c);
+  }
+
+  c->enabled = enabled;
+  c->output_len = 0;
+}
+
+/**
+ * True once there's been a block to measure since the last reset.
+ */
+bool channelizer_is_measured(channelizer ch)
+{
+  return ch->measured;
+}
+
+float channelizer_get_power(channelizer ch, int k)
+{
+  return ch->channels[k].power;
+}
+
+/**
+ * Audio (int16 at the output rate) demodulated from channel k over the last
+ * block, returns the number of samples (0 if it isn't enabled).
+ */
+int channelizer_get_output(channelizer ch, int k, int16_t ** buf)
+{
+  * buf = ch->channels[k].output;
+  return ch->channels[k].output_len;
+}
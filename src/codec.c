@@ -0,0 +1,326 @@
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "macros.h"
+
+// decimation filter, CODEC_FILTER_SPAN taps per output sample
+#define CODEC_FILTER_SPAN 8
+#define CODEC_FILTER_AS 50.0f
+
+struct codec_s
+{
+  codec_type type;
+  unsigned int decim;
+
+  // decimation filter taps (Q15), and its input history twice over so the
+  // last len samples are always contiguous
+  int16_t * h;
+  unsigned int len;
+  int16_t * hist;
+  unsigned int pos;
+  unsigned int phase; // inputs since the last output
+
+  // decimated samples
+  int16_t * buf;
+  unsigned int buf_cap;
+
+  // IMA ADPCM state
+  int predictor;
+  int index;
+};
+
+static const char * _codec_type_names[] = {
+  [CODEC_PCM16] = "pcm16",
+  [CODEC_ULAW] = "ulaw",
+  [CODEC_ALAW] = "alaw",
+  [CODEC_ADPCM] = "adpcm"
+};
+
+static const int _codec_adpcm_index[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int _codec_adpcm_steps[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+  45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+  209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+  2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845,
+  8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+  22385, 24623, 27086, 29794, 32767
+};
+
+const char * codec_lookup_type_name(codec_type type)
+{
+  return _codec_type_names[type];
+}
+
+codec_type codec_lookup_type(const char * s)
+{
+  int i;
+
+  for (i = 0; i < CODEC_NUM_TYPES; i++) {
+    if (strcmp(s, _codec_type_names[i]) == 0) { return (codec_type) i; } }
+
+  return CODEC_NUM_TYPES;
+}
+
+codec codec_create(codec_type type, unsigned int decim)
+{
+  codec c = (codec) malloc(sizeof(struct codec_s));
+
+  float * h, sum = 0.0f;
+  unsigned int i;
+
+  if (decim < 1 || decim > CODEC_MAX_DECIM) {
+    ERROR("Can't decimate audio by %u.\n", decim);
+    exit(1);
+  }
+
+  c->type = type;
+  c->decim = decim;
+
+  c->h = NULL;
+  c->hist = NULL;
+  c->len = 0;
+
+  // unity gain low-pass just inside the new Nyquist rate
+  if (decim > 1) {
+    c->len = CODEC_FILTER_SPAN * decim + 1;
+    c->h = (int16_t *) malloc(c->len * sizeof(int16_t));
+    c->hist = (int16_t *) malloc(2 * c->len * sizeof(int16_t));
+
+    h = (float *) malloc(c->len * sizeof(float));
+    liquid_firdes_kaiser(c->len, 0.45f / decim, CODEC_FILTER_AS, 0.0f, h);
+
+    for (i = 0; i < c->len; i++) { sum += h[i]; }
+    for (i = 0; i < c->len; i++) {
+      c->h[i] = (int16_t) lroundf(h[i] / sum * 32767.0f); }
+
+    free(h);
+  }
+
+  c->buf = NULL;
+  c->buf_cap = 0;
+
+  codec_reset(c);
+
+  return c;
+}
+
+void codec_destroy(codec c)
+{
+  free(c->h);
+  free(c->hist);
+  free(c->buf);
+  free(c);
+}
+
+void codec_reset(codec c)
+{
+  if (c->hist != NULL) { memset(c->hist, 0, 2 * c->len * sizeof(int16_t)); }
+
+  c->pos = 0;
+  c->phase = 0;
+  c->predictor = 0;
+  c->index = 0;
+}
+
+codec_type codec_get_type(codec c)
+{
+  return c->type;
+}
+
+unsigned int codec_get_decim(codec c)
+{
+  return c->decim;
+}
+
+uint8_t codec_get_format(codec c)
+{
+  return (uint8_t) (((c->decim - 1) << 3) | c->type);
+}
+
+size_t codec_get_max_size(codec c, unsigned int n)
+{
+  size_t m = n / c->decim + 1;
+
+  switch (c->type) {
+  case CODEC_PCM16: return m * sizeof(int16_t);
+  case CODEC_ULAW:
+  case CODEC_ALAW: return m;
+  case CODEC_ADPCM: return 4 + (m + 1) / 2;
+  default: return 0;
+  }
+}
+
+/**
+ * Low-pass filters and decimates to c->buf, returns the number of samples.
+ */
+static unsigned int _codec_decimate(codec c, const int16_t * x, unsigned int n)
+{
+  unsigned int i, j, m = 0;
+  const int16_t * b;
+  int32_t acc;
+
+  if (c->buf_cap < n / c->decim + 1) {
+    c->buf_cap = n / c->decim + 1;
+    c->buf = (int16_t *) realloc(c->buf, c->buf_cap * sizeof(int16_t));
+  }
+
+  for (i = 0; i < n; i++) {
+    c->hist[c->pos] = c->hist[c->pos + c->len] = x[i];
+    c->pos = (c->pos + 1) % c->len;
+
+    if (++c->phase < c->decim) { continue; }
+
+    c->phase = 0;
+
+    // the taps are symmetric, so the history's order doesn't matter
+    b = c->hist + c->pos;
+    acc = 0;
+
+    for (j = 0; j < c->len; j++) { acc += (int32_t) c->h[j] * b[j]; }
+
+    acc >>= 15;
+    c->buf[m++] = (int16_t) (acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc);
+  }
+
+  return m;
+}
+
+// G.711, as in the reference implementation
+static uint8_t _codec_ulaw(int16_t v)
+{
+  int s = v, sign = 0, exponent = 7, mask;
+
+  if (s < 0) {
+    s = -s;
+    sign = 0x80;
+  }
+
+  if (s > 32635) { s = 32635; }
+  s += 0x84;
+
+  for (mask = 0x4000; (s & mask) == 0 && exponent > 0; mask >>= 1) {
+    exponent--; }
+
+  return (uint8_t) ~(sign | (exponent << 4) | ((s >> (exponent + 3)) & 0x0f));
+}
+
+static uint8_t _codec_alaw(int16_t v)
+{
+  static const int seg_end[8] = { 0x1f, 0x3f, 0x7f, 0xff,
+				  0x1ff, 0x3ff, 0x7ff, 0xfff };
+  int s = v >> 3, seg, aval;
+  uint8_t mask;
+
+  if (s >= 0) { mask = 0xd5; }
+  else {
+    mask = 0x55;
+    s = -s - 1;
+  }
+
+  for (seg = 0; seg < 8 && s > seg_end[seg]; seg++);
+
+  if (seg == 8) { return (uint8_t) (0x7f ^ mask); }
+
+  aval = seg << 4;
+  aval |= seg < 2 ? (s >> 1) & 0x0f : (s >> seg) & 0x0f;
+
+  return (uint8_t) (aval ^ mask);
+}
+
+static uint8_t _codec_adpcm(codec c, int16_t v)
+{
+  int step = _codec_adpcm_steps[c->index];
+  int diff = v - c->predictor;
+  int delta = step >> 3;
+  uint8_t code = 0;
+
+  if (diff < 0) {
+    code = 8;
+    diff = -diff;
+  }
+
+  if (diff >= step) { code |= 4; diff -= step; delta += step; }
+  step >>= 1;
+  if (diff >= step) { code |= 2; diff -= step; delta += step; }
+  step >>= 1;
+  if (diff >= step) { code |= 1; delta += step; }
+
+  // track what the decoder will reconstruct
+  c->predictor += code & 8 ? -delta : delta;
+  c->predictor = c->predictor > 32767 ? 32767 :
+    c->predictor < -32768 ? -32768 : c->predictor;
+
+  c->index += _codec_adpcm_index[code];
+  c->index = c->index < 0 ? 0 : c->index > 88 ? 88 : c->index;
+
+  return code;
+}
+
+size_t codec_encode(codec c, const int16_t * x, unsigned int n, uint8_t * y,
+		    unsigned int * num_samples)
+{
+  const int16_t * s = x;
+  unsigned int i, m = n;
+
+  if (c->decim > 1) {
+    m = _codec_decimate(c, x, n);
+    s = c->buf;
+  }
+
+  * num_samples = m;
+
+  switch (c->type) {
+  case CODEC_PCM16:
+    for (i = 0; i < m; i++) {
+      y[2*i] = (uint8_t) (s[i] & 0xff);
+      y[2*i+1] = (uint8_t) ((uint16_t) s[i] >> 8);
+    }
+    return 2*m;
+
+  case CODEC_ULAW:
+    for (i = 0; i < m; i++) { y[i] = _codec_ulaw(s[i]); }
+    return m;
+
+  case CODEC_ALAW:
+    for (i = 0; i < m; i++) { y[i] = _codec_alaw(s[i]); }
+    return m;
+
+  case CODEC_ADPCM:
+    // where the decoder starts from
+    y[0] = (uint8_t) (c->predictor & 0xff);
+    y[1] = (uint8_t) ((uint16_t) c->predictor >> 8);
+    y[2] = (uint8_t) c->index;
+    y[3] = (uint8_t) (m % 2);
+
+    for (i = 0; i < m; i++) {
+      if (i % 2 == 0) { y[4 + i/2] = _codec_adpcm(c, s[i]); }
+      else { y[4 + i/2] |= _codec_adpcm(c, s[i]) << 4; }
+    }
+    return 4 + (m + 1) / 2;
+
+  default:
+    return 0;
+  }
+}
+
+unsigned int codec_skip(codec c, unsigned int n)
+{
+  unsigned int m = (c->phase + n) / c->decim;
+
+  // start again from silence when the audio comes back
+  c->phase = (c->phase + n) % c->decim;
+  c->predictor = 0;
+
+  if (c->hist != NULL) { memset(c->hist, 0, 2 * c->len * sizeof(int16_t)); }
+
+  return m;
+}
@@ -1,9 +1,11 @@
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "config.h"
 #include "controller.h"
 #include "demod.h"
 #include "macros.h"
@@ -19,17 +21,40 @@ struct controller_s
   websocket ws;
   int heartbeat_num_samples;
   struct timespec heartbeat_time;
+  uint32_t output_seq; // next demod output block
+  unsigned int output_skipped; // blocks missed by falling behind
+  float spectrum[DEMOD_SPECTRUM_SIZE]; // scratch for clients' spectrum frames
+  unsigned int spectrum_gen; // of the last estimate sent
+
+  // what was sent last, so it's only sent again when it changes
+  unsigned int connections;
+  struct websocket_telemetry_s telemetry;
+  uint8_t * channels; // scratch for the channels message
+  uint8_t * channels_sent;
+  size_t channels_size, channels_cap;
+  int stations[2][STATIONCACHE_SIZE]; // FM then AM
+  int num_stations[2];
 };
 
-static void _rtl_callback(int8_t * buf, int len, void * ctx)
+static void _rtl_callback(uint8_t * buf, int len, uint32_t tune_gen, void * ctx)
 {
   controller ctrl = (controller) ctx;
   
   if (ctrl->dem != NULL) {
-    demod_push(ctrl->dem, buf, len); }
+    demod_push(ctrl->dem, buf, len, tune_gen); }
 }
 
-static void _websocket_receive_callback(void * buf, size_t len, void * ctx)
+static void _websocket_release_callback(void * arg, void * ctx)
+{
+  controller ctrl = (controller) ctx;
+
+  demod_release_block(ctrl->dem, (const struct demod_block_s *) arg);
+}
+
+static void _websocket_receive_callback(void * buf,
+					size_t len,
+					int client,
+					void * ctx)
 {
   controller ctrl = (controller) ctx;
   char * cmd = (char *) buf;
@@ -38,7 +63,7 @@ static void _websocket_receive_callback(void * buf, size_t len, void * ctx)
   cmd[(int) len] = '\0';
 
   // run it
-  controller_command(ctrl, cmd, (int) len);
+  controller_command(ctrl, client, cmd, (int) len);
 }
 
 controller controller_create(demod dem, rtl r, scanner scan, websocket ws)
@@ -51,6 +76,24 @@ controller controller_create(demod dem, rtl r, scanner scan, websocket ws)
   ctrl->ws = ws;
   
   ctrl->heartbeat_num_samples = 0;
+
+  // audio is framed for the websocket in place, in the demod's output blocks
+  demod_set_output_padding(dem, websocket_get_headroom(),
+			   websocket_get_tailroom());
+  websocket_set_release_callback(ws, _websocket_release_callback,
+				 (void *) ctrl);
+
+  ctrl->output_seq = demod_get_output_seq(dem);
+  ctrl->output_skipped = 0;
+
+  ctrl->spectrum_gen = 0;
+  ctrl->connections = 0;
+  memset( & ctrl->telemetry, 0, sizeof(ctrl->telemetry));
+  ctrl->channels = NULL;
+  ctrl->channels_sent = NULL;
+  ctrl->channels_size = 0;
+  ctrl->channels_cap = 0;
+  ctrl->num_stations[0] = ctrl->num_stations[1] = 0;
   
   ctrl->heartbeat_time.tv_sec = (time_t) 0;
   ctrl->heartbeat_time.tv_nsec = 0;
@@ -67,6 +110,9 @@ controller controller_create(demod dem, rtl r, scanner scan, websocket ws)
   demod_set_output_rate(dem, (int) 48e3);
   demod_set_mode(dem, DEMOD_FM);
 
+  // a recording played back as fast as possible mustn't lose blocks
+  demod_set_input_blocking(dem, ! rtl_is_realtime(r));
+
   // start demodulator
   demod_execute(dem);
   
@@ -79,7 +125,11 @@ controller controller_create(demod dem, rtl r, scanner scan, websocket ws)
   return ctrl;
 }
 
-void controller_command(controller ctrl, char * cmd, int len)
+/**
+ * Runs a command from a client; the audio encoding options (-e codec, -o
+ * rate) only apply to that client.
+ */
+void controller_command(controller ctrl, int client, char * cmd, int len)
 {
   DEBUG("Command: %s\n", cmd);
 
@@ -107,20 +157,50 @@ void controller_command(controller ctrl, char * cmd, int len)
   bool change_smode = false;
   scanner_mode smode = SCANNER_OFF;
 
+  // start or stop monitoring the FM channels in the band, or listen to one
+  // of them (0 for the tuned station)
+  bool change_monitor = false;
+  bool monitor = false;
+  int listen_fc = -1;
+
+  // the client's audio
+  codec_type ctype = CODEC_NUM_TYPES;
+  int audio_rate = -1;
+
+  // the client's spectrum frames
+  float spectrum_rate = -1;
+  int spectrum_bins = 256;
+
   // reset getopt
   optind = 1;
 
-  while ((opt = getopt(argc, argv, "f:m:r:s:")) != -1) {
+  while ((opt = getopt(argc, argv, "b:c:e:f:l:m:o:r:s:w:")) != -1) {
     switch (opt) {
+    case 'b':
+      spectrum_bins = atoi(optarg);
+      break;
+    case 'c':
+      change_monitor = true;
+      monitor = ! strcmp(optarg, "on");
+      break;
+    case 'e':
+      ctype = codec_lookup_type(optarg);
+      break;
     case 'f':
       fc = (float) atoi(optarg);
       break;
+    case 'l':
+      listen_fc = atoi(optarg);
+      break;
     case 'r':
       fs = atoi(optarg);
       break;      
     case 'm':
       dmode = demod_lookup_mode(optarg);
       break;
+    case 'o':
+      audio_rate = atoi(optarg);
+      break;
     case 's':
       change_smode = true;
       
@@ -136,16 +216,49 @@ void controller_command(controller ctrl, char * cmd, int len)
       else if ( ! strcmp(optarg, "down")) {
 	smode = SCANNER_SEEK_DOWN;
       }
+      else if ( ! strcmp(optarg, "wide")) {
+	smode = SCANNER_WIDE;
+      }
 
+      break;
+    case 'w':
+      spectrum_rate = atof(optarg);
       break;
     }
   }
 
+  // change how this client's audio is encoded, at the closest rate at or
+  // above the one asked for
+  if (ctype != CODEC_NUM_TYPES) {
+    websocket_set_client_codec(ctrl->ws, client, ctype); }
+
+  if (audio_rate > 0) {
+    int decim = demod_get_output_rate(ctrl->dem) / audio_rate;
+
+    decim = decim < 1 ? 1 : decim > CODEC_MAX_DECIM ? CODEC_MAX_DECIM : decim;
+    websocket_set_client_decim(ctrl->ws, client, (unsigned int) decim);
+  }
+
+  // start or stop sending the client spectrum frames (-b bins only goes with
+  // -w rate), no faster than there are new estimates
+  if (spectrum_rate >= 0 && spectrum_bins >= 16 &&
+      spectrum_bins <= DEMOD_SPECTRUM_SIZE) {
+    float max_rate = demod_get_display_rate(ctrl->dem);
+
+    if (max_rate > 0.0f && spectrum_rate > max_rate) {
+      spectrum_rate = max_rate; }
+
+    websocket_set_client_spectrum(ctrl->ws, client,
+				  (unsigned int) spectrum_bins, spectrum_rate);
+  }
+
   // change sample rate
   if (fs == 250e3 || fs == 1e6 || fs == 1.92e6 || fs == 2e6 || fs == 2.048e6 ||
       fs == 2.4e6) {
     rtl_set_sample_rate(ctrl->r, (uint32_t) fs);
-    demod_set_input_rate(ctrl->dem, fs);
+
+    // the source may not honor the request (e.g. a recording)
+    demod_set_input_rate(ctrl->dem, rtl_get_sample_rate(ctrl->r));
   }
 
   // change demodulation mode
@@ -167,80 +280,234 @@ void controller_command(controller ctrl, char * cmd, int len)
     }
   }
   
-  // change frequency
+  // change frequency (not while the scanner's between choosing a channel and
+  // tuning it)
   if (fc > 0) {
+    scanner_lock_tuning(ctrl->scan);
+
     switch (current_dmode) {
     case DEMOD_FM:
       if (87.9e6 <= fc && fc <= 107.9e6) {
-	rtl_set_center_freq(ctrl->r, (uint32_t) fc);
 	demod_set_center_freq(ctrl->dem, fc);
+	rtl_set_center_freq(ctrl->r, (uint32_t) fc);
       }
       break;
 
     case DEMOD_AM:
       if (540e3 <= fc && fc <= 1700e3) {
-	rtl_set_center_freq(ctrl->r, (uint32_t) (fc + 125e6));
 	demod_set_center_freq(ctrl->dem, fc);
+	rtl_set_center_freq(ctrl->r, (uint32_t) (fc + 125e6));
       }
       break;
       
     default: break;
     }
+
+    scanner_unlock_tuning(ctrl->scan);
   }
 
+  // only measured in FM, but can be left on across modes
+  if (change_monitor) { demod_set_channel_monitor(ctrl->dem, monitor); }
+
+  // listening to another channel needs the monitor
+  if (listen_fc > 0) { demod_set_channel_monitor(ctrl->dem, true); }
+  if (listen_fc >= 0) {
+    demod_set_listen_freq(ctrl->dem, (uint32_t) listen_fc); }
+
   // apply changes to the demodulator
   demod_execute(ctrl->dem);
 }
 
 void controller_destroy(controller ctrl)
 {
+  free(ctrl->channels);
+  free(ctrl->channels_sent);
   free(ctrl);
 }
 
-void _controller_create_header(controller ctrl, char * header, size_t * header_size)
+/**
+ * x to the given number of significant figures.
+ */
+static float _controller_round(float x, int digits)
 {
-  bool scanning;
-  bool seeking;
-  int fc, fs;
-  int last_station_found;
-  float throughput;
-  float snr;
-  const char * dmode_name;
-  scanner_mode smode;
-
-  fc = (int) rtl_get_center_freq(ctrl->r);
-  fs = (int) rtl_get_sample_rate(ctrl->r);
-  dmode_name = demod_get_mode_name(ctrl->dem);
-  throughput = demod_get_throughput(ctrl->dem);
-  snr = demod_get_snr(ctrl->dem);
-  smode = scanner_get_mode(ctrl->scan);
-  scanning = smode == SCANNER_ON;
-  seeking = smode == SCANNER_SEEK_UP || smode == SCANNER_SEEK_DOWN;
-  
-  last_station_found = scanner_get_last_station_found(ctrl->scan);
-    
-  // format JSON string
-  sprintf(header,
-	  ("{\"fc\": %d, \"fs\": %d, \"mode\": \"%s\", \"throughput\": %f, "
-	   "\"snr\": %f, \"scanning\": %d, \"seeking\": %d, "
-	   "\"lastStationFound\": %d }"),
-	  fc, fs, dmode_name, throughput, snr, scanning, seeking,
-	  last_station_found);
-    
-  *header_size = strlen(header);
-} 
+  float scale;
+
+  if (x == 0.0f) { return 0.0f; }
+
+  scale = powf(10.0f, digits - ceilf(log10f(fabsf(x))));
+
+  return roundf(x * scale) / scale;
+}
+
+/**
+ * Telemetry, only sent when it's changed (or someone new's connected, force).
+ * Values are rounded to what's worth showing (whole dB, throughput to two
+ * figures), so noise doesn't count as a change.
+ */
+static void _controller_send_telemetry(controller ctrl, bool force)
+{
+  struct websocket_telemetry_s t;
+
+  memset( & t, 0, sizeof(t));
+  t.header.version = WEBSOCKET_PROTOCOL_VERSION;
+  t.header.type = WEBSOCKET_MSG_TELEMETRY;
+  t.fc = rtl_get_center_freq(ctrl->r);
+  t.fs = rtl_get_sample_rate(ctrl->r);
+  t.snr = roundf(demod_get_snr(ctrl->dem));
+  t.throughput = _controller_round(demod_get_throughput(ctrl->dem), 2);
+  t.last_station_found = scanner_get_last_station_found(ctrl->scan);
+  t.overruns = demod_get_overruns(ctrl->dem);
+  t.underruns = demod_get_underruns(ctrl->dem);
+  t.skipped = ctrl->output_skipped;
+  t.drops = websocket_get_drops(ctrl->ws);
+  t.clients = (uint16_t) websocket_get_num_clients(ctrl->ws);
+  t.mode = (uint8_t) demod_get_mode(ctrl->dem);
+  t.scanner_mode = (uint8_t) scanner_get_mode(ctrl->scan);
+
+  if ( ! force && memcmp( & t, & ctrl->telemetry, sizeof(t)) == 0) { return; }
+
+  websocket_send_state(ctrl->ws, WEBSOCKET_SLOT_TELEMETRY, & t, sizeof(t));
+  ctrl->telemetry = t;
+}
+
+/**
+ * Power in every FM channel of the capture (if it's being monitored), when
+ * it's changed.
+ */
+static void _controller_send_channels(controller ctrl, bool force)
+{
+  struct websocket_channels_s * msg;
+  struct websocket_channel_s * channel;
+  uint32_t fc;
+  float power;
+  size_t size;
+  int k, n;
+
+  for (n = 0; demod_get_channel(ctrl->dem, n, & fc, & power); n++);
+
+  size = sizeof(* msg) + n * sizeof(* channel);
+
+  if (ctrl->channels_cap < size) {
+    ctrl->channels = (uint8_t *) realloc(ctrl->channels, size);
+    ctrl->channels_sent = (uint8_t *) realloc(ctrl->channels_sent, size);
+    ctrl->channels_cap = size;
+  }
+
+  memset(ctrl->channels, 0, size);
+
+  msg = (struct websocket_channels_s *) ctrl->channels;
+  channel = (struct websocket_channel_s *) (msg + 1);
+
+  // (the channels might have gone away since they were counted)
+  for (k = 0; k < n && demod_get_channel(ctrl->dem, k, & fc, & power); k++) {
+    channel[k].fc = fc;
+    channel[k].power = roundf(power);
+  }
+
+  msg->header.version = WEBSOCKET_PROTOCOL_VERSION;
+  msg->header.type = WEBSOCKET_MSG_CHANNELS;
+  msg->num_channels = (uint16_t) k;
+  size = sizeof(* msg) + k * sizeof(* channel);
+
+  if ( ! force && size == ctrl->channels_size &&
+       memcmp(ctrl->channels, ctrl->channels_sent, size) == 0) {
+    return;
+  }
+
+  websocket_send_state(ctrl->ws, WEBSOCKET_SLOT_CHANNELS, ctrl->channels,
+		       size);
+
+  memcpy(ctrl->channels_sent, ctrl->channels, size);
+  ctrl->channels_size = size;
+}
+
+/**
+ * Stations the scanner's found so far, a message per mode whose list has
+ * changed.
+ */
+static void _controller_send_stations(controller ctrl, bool force)
+{
+  struct {
+    struct websocket_stations_s header;
+    uint32_t fcs[STATIONCACHE_SIZE];
+  } __attribute__ ((packed)) msg;
+  int stations[STATIONCACHE_SIZE];
+  demod_mode mode;
+  int k, n;
+
+  for (mode = DEMOD_FM; mode <= DEMOD_AM; mode++) {
+    n = scanner_get_stations(ctrl->scan, mode, stations, STATIONCACHE_SIZE);
+
+    if ( ! force && n == ctrl->num_stations[mode - DEMOD_FM] &&
+	 memcmp(stations, ctrl->stations[mode - DEMOD_FM],
+		n * sizeof(int)) == 0) {
+      continue;
+    }
+
+    memset( & msg.header, 0, sizeof(msg.header));
+    msg.header.header.version = WEBSOCKET_PROTOCOL_VERSION;
+    msg.header.header.type = WEBSOCKET_MSG_STATIONS;
+    msg.header.mode = (uint8_t) mode;
+    msg.header.num_stations = (uint16_t) n;
+
+    for (k = 0; k < n; k++) { msg.fcs[k] = (uint32_t) stations[k]; }
+
+    websocket_send_state(ctrl->ws, mode == DEMOD_FM ?
+			 WEBSOCKET_SLOT_FM_STATIONS : WEBSOCKET_SLOT_AM_STATIONS,
+			 & msg, sizeof(msg.header) + n * sizeof(uint32_t));
+
+    memcpy(ctrl->stations[mode - DEMOD_FM], stations, n * sizeof(int));
+    ctrl->num_stations[mode - DEMOD_FM] = n;
+  }
+}
+
+/**
+ * Everything but the audio and spectrum, each kind sent when it changes.
+ * Someone who's just connected is sent all of it.
+ */
+static void _controller_send_telemetry_all(controller ctrl)
+{
+  unsigned int connections = websocket_get_connections(ctrl->ws);
+  bool force = connections != ctrl->connections;
+
+  ctrl->connections = connections;
+
+  _controller_send_telemetry(ctrl, force);
+  _controller_send_channels(ctrl, force);
+  _controller_send_stations(ctrl, force);
+}
+
+/**
+ * The whole capture's spectrum, to the clients that want it and are due it,
+ * each estimate once.
+ */
+static void _controller_send_spectrum(controller ctrl)
+{
+  unsigned int gen;
+  int n;
+
+  demod_set_display_spectrum(ctrl->dem, websocket_wants_spectrum(ctrl->ws));
+
+  if ( ! websocket_is_spectrum_due(ctrl->ws)) { return; }
+
+  n = demod_get_display_spectrum(ctrl->dem, ctrl->spectrum, DEMOD_SPECTRUM_SIZE,
+				 & gen);
+  if (n == 0 || gen == ctrl->spectrum_gen) { return; }
+
+  ctrl->spectrum_gen = gen;
+
+  websocket_send_spectrum(ctrl->ws, rtl_get_center_freq(ctrl->r),
+			  rtl_get_sample_rate(ctrl->r), ctrl->spectrum,
+			  (unsigned int) n);
+}
 
 void controller_execute(controller ctrl)
 {
   struct timespec time;
   float dt;
   
-  char header[2048];
-  size_t header_size = 0;
-  
-  int16_t * data;
-  int data_len;
-  size_t data_size;
+  const struct demod_block_s * block;
+  unsigned int skipped;
   
   clock_gettime(CLOCK_REALTIME_COARSE, & time);
 
@@ -249,7 +516,7 @@ void controller_execute(controller ctrl)
   dt += (time.tv_nsec - ctrl->heartbeat_time.tv_nsec) / 1e9;
 
   if (dt >= 0.25f) {
-    _controller_create_header(ctrl, header, & header_size);
+    _controller_send_telemetry_all(ctrl);
 
     // reset sample count
     ctrl->heartbeat_num_samples = 0;
@@ -262,16 +529,27 @@ void controller_execute(controller ctrl)
   // give control to the scanner
   scanner_execute(ctrl->scan, ctrl->dem, ctrl->r);
 
+  _controller_send_spectrum(ctrl);
+
   // block until new output is available
-  demod_pop_and_lock(ctrl->dem, & data, & data_len);
-  
-  data_size = data_len * sizeof(int16_t);
+  block = demod_acquire_block(ctrl->dem, & ctrl->output_seq, & skipped);
 
-  // send to client
-  websocket_send(ctrl->ws, header, header_size, data, data_size);
+  if (block == NULL) { return; }
 
-  demod_release(ctrl->dem);
+  ctrl->output_skipped += skipped;
 
   // keep count
-  ctrl->heartbeat_num_samples += data_len;
+  ctrl->heartbeat_num_samples += block->len;
+
+  // send to client, only how long the silence is while squelched
+  if (block->silent) {
+    websocket_send_silence(ctrl->ws, block->seq, & block->time, block->len);
+    demod_release_block(ctrl->dem, block);
+  }
+  else {
+    // the websocket encodes it or writes it from the demod's block, and
+    // releases it
+    websocket_send_audio(ctrl->ws, block->seq, & block->time, block->data,
+			 block->len, (void *) block);
+  }
 }
@@ -0,0 +1,271 @@
+#include <complex.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#include "convert.h"
+
+#define CONVERT_S16_MAX 32767.0f
+#define CONVERT_S16_MIN -32768.0f
+
+typedef void (* convert_u8_to_cf_fn)(const uint8_t * x, float complex * y,
+				     size_t n);
+typedef void (* convert_f_to_s16_fn)(const float * x, int16_t * y, size_t n,
+				     float scale);
+
+struct convert_kernels_s
+{
+  const char * name;
+  convert_u8_to_cf_fn u8_to_cf;
+  convert_f_to_s16_fn f_to_s16;
+};
+
+/*
+ * scalar
+ */
+
+static void _convert_u8_to_cf_scalar(const uint8_t * x, float complex * y,
+				     size_t n)
+{
+  float * z = (float *) y;
+  size_t i;
+
+  for (i = 0; i < 2*n; i++) {
+    z[i] = ((float) x[i]) - 128.0f;
+  }
+}
+
+static void _convert_f_to_s16_scalar(const float * x, int16_t * y, size_t n,
+				     float scale)
+{
+  float t;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    t = x[i] * scale;
+
+    if (t > CONVERT_S16_MAX) { t = CONVERT_S16_MAX; }
+    else if (t < CONVERT_S16_MIN) { t = CONVERT_S16_MIN; }
+
+    y[i] = (int16_t) t;
+  }
+}
+
+/*
+ * SSE2 / AVX2
+ */
+
+#if defined(__SSE2__)
+
+static void _convert_u8_to_cf_sse2(const uint8_t * x, float complex * y,
+				   size_t n)
+{
+  float * z = (float *) y;
+  size_t i, m = 2*n;
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 offset = _mm_set1_ps(128.0f);
+
+  for (i = 0; i + 16 <= m; i += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *) (x + i));
+    __m128i lo = _mm_unpacklo_epi8(b, zero);
+    __m128i hi = _mm_unpackhi_epi8(b, zero);
+
+    _mm_storeu_ps(z + i,
+		  _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), offset));
+    _mm_storeu_ps(z + i + 4,
+		  _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), offset));
+    _mm_storeu_ps(z + i + 8,
+		  _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), offset));
+    _mm_storeu_ps(z + i + 12,
+		  _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), offset));
+  }
+
+  // leftovers
+  _convert_u8_to_cf_scalar(x + i, (float complex *) (z + i), (m - i) / 2);
+}
+
+static void _convert_f_to_s16_sse2(const float * x, int16_t * y, size_t n,
+				   float scale)
+{
+  size_t i;
+
+  const __m128 s = _mm_set1_ps(scale);
+  const __m128 hi = _mm_set1_ps(CONVERT_S16_MAX);
+  const __m128 lo = _mm_set1_ps(CONVERT_S16_MIN);
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(x + i), s);
+    __m128 b = _mm_mul_ps(_mm_loadu_ps(x + i + 4), s);
+
+    // clamp first, out of range conversions don't saturate
+    a = _mm_max_ps(_mm_min_ps(a, hi), lo);
+    b = _mm_max_ps(_mm_min_ps(b, hi), lo);
+
+    _mm_storeu_si128((__m128i *) (y + i),
+		     _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+  }
+
+  _convert_f_to_s16_scalar(x + i, y + i, n - i, scale);
+}
+
+__attribute__ ((target ("avx2")))
+static void _convert_u8_to_cf_avx2(const uint8_t * x, float complex * y,
+				   size_t n)
+{
+  float * z = (float *) y;
+  size_t i, m = 2*n;
+
+  const __m256 offset = _mm256_set1_ps(128.0f);
+
+  for (i = 0; i + 16 <= m; i += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *) (x + i));
+
+    _mm256_storeu_ps(z + i,
+		     _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)),
+				   offset));
+    _mm256_storeu_ps(z + i + 8,
+		     _mm256_sub_ps(_mm256_cvtepi32_ps(
+				     _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))),
+				   offset));
+  }
+
+  _convert_u8_to_cf_scalar(x + i, (float complex *) (z + i), (m - i) / 2);
+}
+
+__attribute__ ((target ("avx2")))
+static void _convert_f_to_s16_avx2(const float * x, int16_t * y, size_t n,
+				   float scale)
+{
+  size_t i;
+
+  const __m256 s = _mm256_set1_ps(scale);
+  const __m256 hi = _mm256_set1_ps(CONVERT_S16_MAX);
+  const __m256 lo = _mm256_set1_ps(CONVERT_S16_MIN);
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m256 a = _mm256_mul_ps(_mm256_loadu_ps(x + i), s);
+    __m256 b = _mm256_mul_ps(_mm256_loadu_ps(x + i + 8), s);
+
+    a = _mm256_max_ps(_mm256_min_ps(a, hi), lo);
+    b = _mm256_max_ps(_mm256_min_ps(b, hi), lo);
+
+    // packs works within 128-bit lanes, put the quarters back in order
+    __m256i p = _mm256_packs_epi32(_mm256_cvttps_epi32(a),
+				   _mm256_cvttps_epi32(b));
+    p = _mm256_permute4x64_epi64(p, 0xd8);
+
+    _mm256_storeu_si256((__m256i *) (y + i), p);
+  }
+
+  _convert_f_to_s16_scalar(x + i, y + i, n - i, scale);
+}
+
+#endif
+
+/*
+ * NEON
+ */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static void _convert_u8_to_cf_neon(const uint8_t * x, float complex * y,
+				   size_t n)
+{
+  float * z = (float *) y;
+  size_t i, m = 2*n;
+
+  const float32x4_t offset = vdupq_n_f32(128.0f);
+
+  for (i = 0; i + 16 <= m; i += 16) {
+    uint8x16_t b = vld1q_u8(x + i);
+    uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+
+    vst1q_f32(z + i,
+	      vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), offset));
+    vst1q_f32(z + i + 4,
+	      vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), offset));
+    vst1q_f32(z + i + 8,
+	      vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), offset));
+    vst1q_f32(z + i + 12,
+	      vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), offset));
+  }
+
+  _convert_u8_to_cf_scalar(x + i, (float complex *) (z + i), (m - i) / 2);
+}
+
+static void _convert_f_to_s16_neon(const float * x, int16_t * y, size_t n,
+				   float scale)
+{
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    // float to int conversion and narrowing both saturate
+    int32x4_t a = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(x + i), scale));
+    int32x4_t b = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(x + i + 4), scale));
+
+    vst1q_s16(y + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+  }
+
+  _convert_f_to_s16_scalar(x + i, y + i, n - i, scale);
+}
+
+#endif
+
+static struct convert_kernels_s _convert_kernels = {
+  "scalar",
+  _convert_u8_to_cf_scalar,
+  _convert_f_to_s16_scalar
+};
+
+void convert_init()
+{
+#if defined(__SSE2__)
+  _convert_kernels.name = "sse2";
+  _convert_kernels.u8_to_cf = _convert_u8_to_cf_sse2;
+  _convert_kernels.f_to_s16 = _convert_f_to_s16_sse2;
+
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    _convert_kernels.name = "avx2";
+    _convert_kernels.u8_to_cf = _convert_u8_to_cf_avx2;
+    _convert_kernels.f_to_s16 = _convert_f_to_s16_avx2;
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#if defined(__arm__)
+  // built with -mfpu=neon, but not every ARMv7 part has it
+  if ( ! (getauxval(AT_HWCAP) & HWCAP_NEON)) { return; }
+#endif
+  _convert_kernels.name = "neon";
+  _convert_kernels.u8_to_cf = _convert_u8_to_cf_neon;
+  _convert_kernels.f_to_s16 = _convert_f_to_s16_neon;
+#endif
+}
+
+const char * convert_get_name()
+{
+  return _convert_kernels.name;
+}
+
+void convert_u8_to_cf(const uint8_t * x, float complex * y, size_t n)
+{
+  _convert_kernels.u8_to_cf(x, y, n);
+}
+
+void convert_f_to_s16(const float * x, int16_t * y, size_t n, float scale)
+{
+  _convert_kernels.f_to_s16(x, y, n, scale);
+}
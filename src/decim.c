@@ -0,0 +1,209 @@
+#include <complex.h>
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decim.h"
+#include "macros.h"
+
+#define DECIM_CIC_ORDER 4
+#define DECIM_MAX_LOG2_FACTOR 6 /* CIC growth 4*5 bits on 8-bit input */
+
+// half-band filter, 4m+1 taps of which 2m+1 aren't zero
+#define DECIM_HB_M 5
+#define DECIM_HB_LEN (4 * DECIM_HB_M + 1)
+#define DECIM_HB_AS 60.0f
+
+// CIC output is scaled to this many bits above the 8-bit input
+#define DECIM_CIC_EXTRA_BITS 7
+
+struct decim_s
+{
+  unsigned int log2_factor;
+
+  // CIC decimating by R (1 means it's bypassed), in modular arithmetic
+  unsigned int R;
+  int shift;
+  uint32_t integ[2][DECIM_CIC_ORDER];
+  uint32_t comb[2][DECIM_CIC_ORDER];
+  unsigned int count;
+
+  // half-band taps (Q15), and its input: history then this block's CIC output
+  int16_t hb[DECIM_HB_LEN];
+  int16_t * buf;
+  unsigned int odd; // whether the next half-band input is skipped
+
+  unsigned int max_input;
+};
+
+unsigned int decim_lookup_log2_factor(float r)
+{
+  unsigned int k = 0;
+
+  while (k < DECIM_MAX_LOG2_FACTOR && r * (1 << (k + 1)) <= 1.0f) { k++; }
+
+  return k;
+}
+
+decim decim_create(unsigned int log2_factor, unsigned int max_input)
+{
+  decim d = (decim) malloc(sizeof(struct decim_s));
+
+  float h[DECIM_HB_LEN];
+  int i;
+
+  if (log2_factor < 1 || log2_factor > DECIM_MAX_LOG2_FACTOR) {
+    ERROR("Can't decimate by 2^%u.\n", log2_factor);
+    exit(1);
+  }
+
+  d->log2_factor = log2_factor;
+  d->R = 1 << (log2_factor - 1);
+
+  // undo the CIC gain of R^order, keeping some extra precision
+  d->shift = DECIM_CIC_ORDER * (log2_factor - 1) - DECIM_CIC_EXTRA_BITS;
+
+  // every other tap of a half-band is zero, the center is exactly 1/2
+  liquid_firdes_kaiser(DECIM_HB_LEN, 0.25f, DECIM_HB_AS, 0.0f, h);
+
+  for (i = 0; i < DECIM_HB_LEN; i++) {
+    int j = i - 2 * DECIM_HB_M;
+
+    if (j == 0) { d->hb[i] = 16384; }
+    else if (j % 2 == 0) { d->hb[i] = 0; }
+    else { d->hb[i] = (int16_t) lroundf(h[i] / h[2 * DECIM_HB_M] * 16384.0f); }
+  }
+
+  d->max_input = max_input;
+  d->buf = (int16_t *) malloc(2 * (DECIM_HB_LEN - 1 + max_input / d->R + 1) *
+			      sizeof(int16_t));
+
+  decim_reset(d);
+
+  return d;
+}
+
+void decim_destroy(decim d)
+{
+  free(d->buf);
+  free(d);
+}
+
+void decim_reset(decim d)
+{
+  memset(d->integ, 0, sizeof(d->integ));
+  memset(d->comb, 0, sizeof(d->comb));
+  memset(d->buf, 0, 2 * (DECIM_HB_LEN - 1) * sizeof(int16_t));
+
+  d->count = 0;
+  d->odd = 0;
+}
+
+float decim_estimate_cost(unsigned int log2_factor)
+{
+  float R = (float) (1 << (log2_factor - 1));
+
+  // integrators on every input, combs on every CIC output (or just a shift
+  // when bypassed), then half-band and conversion on every other one
+  float cic = R > 1.0f ? 2.0f * DECIM_CIC_ORDER * (1.0f + 1.0f / R) : 2.0f;
+  float hb = (4.0f * (2 * DECIM_HB_M + 1) + 2.0f) / (2.0f * R);
+
+  return cic + hb;
+}
+
+unsigned int decim_get_factor(decim d)
+{
+  return 1 << d->log2_factor;
+}
+
+/**
+ * CIC stage, writes its output after the half-band history and returns how
+ * many IQ pairs it wrote.
+ */
+static unsigned int _decim_cic(decim d, const uint8_t * x, unsigned int n)
+{
+  int16_t * y = d->buf + 2 * (DECIM_HB_LEN - 1);
+  unsigned int i, c, s, m = 0;
+  uint32_t v, t;
+
+  if (d->R == 1) {
+    for (i = 0; i < 2*n; i++) {
+      y[i] = (int16_t) (((int) x[i] - 128) << DECIM_CIC_EXTRA_BITS); }
+
+    return n;
+  }
+
+  for (i = 0; i < n; i++) {
+    for (c = 0; c < 2; c++) {
+      v = (uint32_t) ((int32_t) x[2*i+c] - 128);
+
+      for (s = 0; s < DECIM_CIC_ORDER; s++) { v = d->integ[c][s] += v; }
+    }
+
+    if (++d->count < d->R) { continue; }
+
+    d->count = 0;
+
+    for (c = 0; c < 2; c++) {
+      v = d->integ[c][DECIM_CIC_ORDER - 1];
+
+      for (s = 0; s < DECIM_CIC_ORDER; s++) {
+	t = v;
+	v -= d->comb[c][s];
+	d->comb[c][s] = t;
+      }
+
+      // the modular result is exact once all the combs have run
+      y[2*m+c] = (int16_t) (d->shift >= 0 ? (int32_t) v >> d->shift
+			    : (int32_t) v << -d->shift);
+    }
+
+    m++;
+  }
+
+  return m;
+}
+
+void decim_execute_cu8(decim d,
+		       const uint8_t * x,
+		       unsigned int n,
+		       float complex * y,
+		       unsigned int * ny)
+{
+  // back to convert_u8_to_cf units
+  const float scale = 1.0f / (32768.0f * (1 << DECIM_CIC_EXTRA_BITS));
+
+  unsigned int m, chunk, i, j, k = 0;
+  int32_t ai, aq;
+  const int16_t * b;
+
+  while (n > 0) {
+    chunk = n < d->max_input ? n : d->max_input;
+    m = _decim_cic(d, x, chunk);
+
+    // half-band, every other sample
+    for (i = d->odd; i < m; i += 2) {
+      b = d->buf + 2*i;
+      ai = 0;
+      aq = 0;
+
+      for (j = 0; j < DECIM_HB_LEN; j++) {
+	ai += (int32_t) d->hb[j] * b[2*j];
+	aq += (int32_t) d->hb[j] * b[2*j+1];
+      }
+
+      y[k++] = ((float) ai + ((float) aq) * _Complex_I) * scale;
+    }
+
+    d->odd = i - m;
+
+    memmove(d->buf, d->buf + 2*m, 2 * (DECIM_HB_LEN - 1) * sizeof(int16_t));
+
+    x += 2*chunk;
+    n -= chunk;
+  }
+
+  * ny = k;
+}
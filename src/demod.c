@@ -1,7 +1,11 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+
 #include <complex.h>
 #include <liquid/liquid.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -9,9 +13,19 @@
 #include <string.h>
 #include <time.h>
 
+#include "channelizer.h"
 #include "config.h"
+#include "convert.h"
+#include "decim.h"
 #include "demod.h"
+#include "detect.h"
+#include "filtercache.h"
 #include "macros.h"
+#include "ols.h"
+#include "qresamp.h"
+#include "ring.h"
+#include "seqlock.h"
+#include "spectrum.h"
 
 #define NF (1.0f / 32767.0f) /* normalization factor for float to int16 */
 
@@ -23,66 +37,250 @@ struct demod_common_s
   uint32_t center_freq;
   int input_rate;
   int output_rate;
+
+  // clear filter state when only the frequency changes
+  bool reset_on_retune;
+
+  // use the integer pipelines
+  bool fixed_point;
+
+  // first stage filtering for each mode's float pipeline
+  demod_filter fm_filter;
+  demod_filter am_filter;
 };
 
 struct demod_am_s
 {
-  ampmodem dem;
+  // rates (and arithmetic) the filters were designed for
+  int input_rate;
+  int output_rate;
+  bool fixed;
+  demod_filter filter;
+
+  // integer power of two decimation ahead of resamp1, if there's room, or
+  // instead an FFT filter taking the integer part of the decimation
+  decim front;
+  ols fast;
+
   msresamp_crcf resamp1;
   float r1;
   float mi;
+
+  // largest block resamp1 (or qresamp1) can give at these rates
+  unsigned int y_cap;
+
+  // fixed-point pipeline
+  qresamp qresamp1;
+  int32_t carrier_q;
+  unsigned int alpha_shift;
+
+  // envelope detector state
+  float carrier;
+  float alpha;
 };
 
 struct demod_fm_s
 {
-  freqdem dem;
+  // rates (and arithmetic) the filters were designed for
+  int input_rate;
+  int output_rate;
+  bool fixed;
+  demod_filter filter;
+
+  float complex prev; // discriminator state
   float kf;
+
+  // integer power of two decimation ahead of resamp1, if there's room, or
+  // instead an FFT filter taking the integer part of the decimation
+  decim front;
+  ols fast;
+
   msresamp_crcf resamp1;
   resamp_rrrf resamp2;
   float r1;
   float r2;
+
+  // largest block resamp1 (or qresamp1) can give at these rates, and audio
+  // stage scratch for resamp2's output
+  unsigned int y_cap;
+  float * z;
+  unsigned int z_cap;
+
+  // fixed-point pipeline
+  qresamp qresamp1;
+  qresamp qresamp2;
+  int16_t phase;
 };
 
 struct demod_metrics_s
 {
-  float snr;
   float throughput;
 };
 
+/**
+ * Output blocks go to any number of readers, and one's never reused while a
+ * reader still holds it.
+ */
+struct demod_slot_s
+{
+  struct demod_block_s block; // first, so a block is its slot
+  void * mem; // block data, behind the headroom
+
+  int refs; // readers', and the writing stage's until it's published
+  bool in_ring; // can still be found through output_index
+};
+
+// the ring, what readers hold and the blocks being written (by the audio
+// and channels stages)
+#define DEMOD_OUTPUT_SLOTS (DEMOD_OUTPUT_DEPTH + DEMOD_OUTPUT_READERS + 2)
+
+struct demod_squelch_s
+{
+  bool open;
+
+  // blocks left below the closing threshold before it closes
+  unsigned int hold;
+
+  // fraction of an output sample carried over between silent blocks
+  double owed;
+
+  // tuning the state belongs to
+  uint32_t tag;
+};
+
+/**
+ * Bounded queue of blocks between two threads, a ring plus the conditions
+ * either side waits on when it's empty or full.
+ */
+struct demod_queue_s
+{
+  ring r;
+  pthread_cond_t ready;
+  pthread_mutex_t ready_m;
+  pthread_cond_t space;
+  pthread_mutex_t space_m;
+};
+
+/**
+ * Blocks passed between stages start with this header, padded out to a cache
+ * line so the samples after it stay aligned.
+ */
+struct demod_packet_s
+{
+  // configuration the samples were produced under (see demod_execute)
+  unsigned int gen;
+
+  // samples (or IQ pairs) that follow
+  unsigned int n;
+
+  // CPU time (s) the busiest stage so far spent on the block
+  float busy;
+
+  // squelched, n is just the number of output samples it stands for
+  bool silent;
+
+  // the squelch has just opened, the stage clears its filter state first
+  bool flush;
+};
+
+#define DEMOD_PACKET_DATA(p) ((void *) ((uint8_t *) (p) + CACHE_LINE_SIZE))
+
 struct demod_s
 {
-  pthread_t thread;
+  // one thread per pipeline stage, optionally pinned to a CPU (-1 if not)
+  pthread_t threads[DEMOD_NUM_STAGES];
+  int cpus[DEMOD_NUM_STAGES];
+
+  // held by a stage while it runs its filters, and by demod_execute (all of
+  // them) while it changes them
+  pthread_mutex_t stage_m[DEMOD_NUM_STAGES];
+
+  // bumped (with every stage locked) whenever filters are rebuilt or reset,
+  // so blocks still queued from before are dropped rather than mixed in
+  unsigned int gen;
   
-  // common parameters
+  // common parameters, read without locking (see _demod_get_common)
   struct demod_common_s common;
-  pthread_mutex_t common_m;
+  struct seqlock_s common_lock;
+
+  // parameters as of the last demod_execute (only changed by it, with every
+  // stage locked, so the stages read it under their own lock)
+  struct demod_common_s applied;
 
   // FM parameters
   struct demod_fm_s fm;
-  pthread_mutex_t fm_m;
 
   // AM parameters
   struct demod_am_s am;
-  pthread_mutex_t am_m; 
-
-  // input buffer
-  int8_t input[RTL_MAX_BUFFER_LENGTH];
-  int input_len;
-  pthread_mutex_t input_m;
-  pthread_cond_t input_ready;
-  pthread_mutex_t input_ready_m;
-
-  // output buffer
-  int16_t output[RTL_MAX_BUFFER_LENGTH];
-  int output_len;
+
+  // raw input blocks, pushed by the RTL thread and consumed by the front end
+  struct demod_queue_s input;
+
+  // when set, demod_push waits for room instead of dropping blocks
+  bool input_blocking;
+
+  // front end -> detector -> audio, blocks of demod_packet_s
+  struct demod_queue_s decimated;
+  struct demod_queue_s detected;
+
+  // copies of the raw input for the spectrum, dropped if it falls behind
+  struct demod_queue_s raw;
+
+  // and for the channel monitor, every block while it's on
+  struct demod_queue_s band;
+
+  // converted input block and the squelch (only the front end uses them)
+  float complex * x;
+  unsigned int x_cap;
+  struct demod_squelch_s squelch;
+
+  // output blocks: the last DEMOD_OUTPUT_DEPTH are found by sequence
+  // number, the spare slots stand in for ones readers are still holding
+  struct demod_slot_s output_slots[DEMOD_OUTPUT_SLOTS];
+  struct demod_slot_s * output_index[DEMOD_OUTPUT_DEPTH];
+  uint32_t output_seq; // number of the next block
+  size_t output_headroom; // bytes free before and after each block's data
+  size_t output_tailroom;
   pthread_mutex_t output_m;
   pthread_cond_t output_ready;
-  pthread_mutex_t output_ready_m;
 
   // metrics
   struct demod_metrics_s metrics;
   pthread_mutex_t metrics_m;
 
+  // spectral estimate of the input, drives SNR (read without locking)
+  spectrum spectrum;
+
+  // tuning (see rtl_get_tune_gen) of the samples the spectrum's measuring
+  atomic_uint tune_gen;
+
+  // the front end only copies every raw_cadence-th block for the metrics
+  // stage (counting from the first at a new tuning, raw_tag), the spectra's
+  // cadences count the copies
+  atomic_uint raw_cadence;
+  unsigned int raw_count;
+  uint32_t raw_tag;
+
+  // the whole capture, for clients to look at (only fed while enabled)
+  spectrum display;
+  atomic_bool display_enabled;
+  atomic_uint block_len; // IQ pairs in the latest raw block
+
+  // power in every FM channel in the band (NULL unless it's being
+  // monitored), measured under channels_tag with the demod at channels_fc
+  channelizer channels;
+  atomic_bool channels_enabled;
+  uint32_t channels_tag;
+  uint32_t channels_fc;
+  pthread_mutex_t channels_m;
+
+  // the channel listened to instead of the tuned station (0 if none), the
+  // one it's found to be (-1 if it isn't in the band), and whether its audio
+  // is being published in place of the audio stage's
+  uint32_t listen_fc;
+  int listen_k;
+  atomic_bool listening;
+
   // operational state
   demod_state state;
   pthread_mutex_t state_m;
@@ -104,6 +302,20 @@ void _demod_set_state(demod dem, demod_state state)
   pthread_mutex_unlock( & dem->state_m);
 }
 
+/**
+ * Consistent copy of the common parameters, without taking a lock (the
+ * setters only hold up readers for the few stores they make).
+ */
+static void _demod_get_common(demod dem, struct demod_common_s * common)
+{
+  unsigned int seq;
+
+  do {
+    seq = seqlock_read_begin( & dem->common_lock);
+    * common = dem->common;
+  } while (seqlock_read_retry( & dem->common_lock, seq));
+}
+
 static const unsigned int _demod_num_modes = 6;
 
 static const char * _demod_mode_names[] = {
@@ -142,103 +354,415 @@ int demod_lookup_frequency_step(demod_mode mode)
   return _demod_mode_frequency_steps[mode];
 };
 
-void _demod_am(demod dem);
-void _demod_am_init(demod dem);
+/**
+ * Scratch buffers are cache-line aligned, so the conversion and detector
+ * kernels get aligned loads, and allocated outside the hot path.
+ */
+static void * _demod_alloc(size_t size)
+{
+  void * p;
+
+  if (posix_memalign( & p, CACHE_LINE_SIZE, size)) {
+    ERROR("Failed to allocate demod buffers.\n");
+    exit(1);
+  }
+
+  return p;
+}
+
+/**
+ * (Re)allocates the output blocks with the current head- and tailroom.
+ */
+static void _demod_alloc_output(demod dem)
+{
+  struct demod_slot_s * slot;
+  int i;
+
+  for (i = 0; i < DEMOD_OUTPUT_SLOTS; i++) {
+    slot = & dem->output_slots[i];
+
+    free(slot->mem);
+
+    slot->mem = _demod_alloc(dem->output_headroom +
+			     RTL_MAX_BUFFER_LENGTH * sizeof(int16_t) +
+			     dem->output_tailroom);
+    slot->block.data = (int16_t *) ((char *) slot->mem + dem->output_headroom);
+  }
+}
+
+// largest number of intermediate samples resampling a full block by r gives
+// (the resamplers can run a sample or two ahead of the nominal ratio)
+static unsigned int _demod_max_output(unsigned int nx, float r)
+{
+  return (unsigned int) ceilf(r * (float) nx) + 2;
+}
+
+// largest packet between stages holds as many complex samples as a block
+static unsigned int _demod_packet_cap(demod dem)
+{
+  return _demod_max_output(dem->x_cap, 1.0f);
+}
+
+static void _demod_check_packet_cap(demod dem, unsigned int y_cap)
+{
+  if (y_cap > _demod_packet_cap(dem)) {
+    ERROR("Demod stage blocks are too small for these rates.\n");
+    exit(1);
+  }
+}
+
+static void _demod_queue_init(struct demod_queue_s * q,
+			      unsigned int depth,
+			      size_t block_size)
+{
+  q->r = ring_create(depth, block_size);
+
+  pthread_cond_init( & q->ready, NULL);
+  pthread_mutex_init( & q->ready_m, NULL);
+  pthread_cond_init( & q->space, NULL);
+  pthread_mutex_init( & q->space_m, NULL);
+}
+
+static void _demod_queue_destroy(struct demod_queue_s * q)
+{
+  pthread_cond_destroy( & q->ready);
+  pthread_mutex_destroy( & q->ready_m);
+  pthread_cond_destroy( & q->space);
+  pthread_mutex_destroy( & q->space_m);
+
+  ring_destroy(q->r);
+}
+
+/**
+ * Consumer side, blocks until there's a block to process. Returns NULL if
+ * we're exiting instead.
+ */
+static struct ring_block_s * _demod_queue_wait(demod dem,
+					       struct demod_queue_s * q)
+{
+  struct ring_block_s * block;
+
+  pthread_mutex_lock( & q->ready_m);
+
+  while ((block = ring_peek(q->r)) == NULL &&
+	 _demod_get_state(dem) != DEMOD_EXITING) {
+    pthread_cond_wait( & q->ready, & q->ready_m);
+  }
+
+  pthread_mutex_unlock( & q->ready_m);
+
+  return block;
+}
+
+// hands the oldest block back to the producer
+static void _demod_queue_release(struct demod_queue_s * q)
+{
+  ring_release(q->r);
+  safe_cond_signal( & q->space, & q->space_m);
+}
+
+/**
+ * Producer side, blocks until there's room for a block (a stage waits for
+ * the next one to catch up rather than drop its output). Returns NULL if
+ * we're exiting instead.
+ */
+static struct ring_block_s * _demod_queue_acquire(demod dem,
+						  struct demod_queue_s * q)
+{
+  pthread_mutex_lock( & q->space_m);
+
+  while (ring_is_full(q->r) && _demod_get_state(dem) != DEMOD_EXITING) {
+    pthread_cond_wait( & q->space, & q->space_m);
+  }
+
+  pthread_mutex_unlock( & q->space_m);
+
+  return _demod_get_state(dem) != DEMOD_EXITING ? ring_acquire(q->r) : NULL;
+}
+
+static void _demod_queue_commit(struct demod_queue_s * q)
+{
+  ring_commit(q->r);
+  safe_cond_signal( & q->ready, & q->ready_m);
+}
+
+// wakes both sides of a queue so they notice we're exiting
+static void _demod_queue_wake(struct demod_queue_s * q)
+{
+  safe_cond_signal( & q->ready, & q->ready_m);
+  safe_cond_signal( & q->space, & q->space_m);
+}
+
+static void _demod_lock_stages(demod dem)
+{
+  int i;
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) {
+    pthread_mutex_lock( & dem->stage_m[i]); }
+}
+
+static void _demod_unlock_stages(demod dem)
+{
+  int i;
+
+  for (i = DEMOD_NUM_STAGES - 1; i >= 0; i--) {
+    pthread_mutex_unlock( & dem->stage_m[i]); }
+}
+
+// CPU time (s) used by the calling thread
+static double _demod_thread_time()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, & ts);
+
+  return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+/**
+ * Integer front end for the power of two part of a decimation by r, NULL if
+ * there isn't one (r > 1/2).
+ */
+static decim _demod_front_create(demod dem, float r)
+{
+  unsigned int k = decim_lookup_log2_factor(r);
+
+  return k > 0 ? decim_create(k, dem->x_cap) : NULL;
+}
+
+// what's left of r for the float resampler
+static float _demod_front_residual(decim front, float r)
+{
+  return front != NULL ? r * decim_get_factor(front) : r;
+}
+
+/**
+ * Overlap-save filter for the integer part of a decimation by r (the passband
+ * is the same fraction of the output band as qresamp's), if it's been asked
+ * for or it's estimated to be cheaper than the time-domain front end.
+ * Aliases are only let into the transition band.
+ */
+static ols _demod_fast_create(demod_filter filter, float r, float As)
+{
+  unsigned int D = (unsigned int) floorf(1.0f / r);
+  unsigned int k = decim_lookup_log2_factor(r);
+
+  float fp = 0.8f * r / 2.0f;
+  float fs = 1.0f / D - fp < 0.5f ? 1.0f / D - fp : 0.5f;
+
+  if (D < 2 || filter == DEMOD_FILTER_TIME) { return NULL; }
+
+  if (filter == DEMOD_FILTER_AUTO) {
+    float time_cost = k > 0 ? decim_estimate_cost(k) : 2.0f;
+
+    if (ols_estimate_cost(D, fs - fp, As) >= time_cost) { return NULL; }
+  }
+
+  return ols_create(D, (fp + fs) / 2.0f, fs - fp, As);
+}
+
+/**
+ * Takes a raw block to complex floats in dem->x, decimating first if there's
+ * a front end; *n is updated to the number of samples in dem->x.
+ */
+static void _demod_front_execute(demod dem,
+				 decim front,
+				 ols fast,
+				 const uint8_t * input,
+				 unsigned int * n)
+{
+  if (fast != NULL) { ols_execute_cu8(fast, input, * n, dem->x, n); }
+  else if (front != NULL) { decim_execute_cu8(front, input, * n, dem->x, n); }
+  else { convert_u8_to_cf(input, dem->x, * n); }
+}
+
+/**
+ * Each mode is split into the three stages' worth of work: the front end
+ * takes nx raw IQ pairs down to the intermediate rate, the detector
+ * demodulates those, and the audio stage gets the result to int16 at the
+ * output rate. Each returns the number of samples it wrote to y. The mode
+ * functions are only called with their stage's lock held, init, reset and
+ * teardown with every stage's.
+ */
+void _demod_am_init(demod dem, struct demod_common_s * common);
+void _demod_am_reset(demod dem);
 void _demod_am_teardown(demod dem);
 
-void _demod_am_init(demod dem)
+void _demod_am_init(demod dem, struct demod_common_s * common)
 {
   // make sure any previously allocated memory is freed
   _demod_am_teardown(dem);
   
-  pthread_mutex_lock( & dem->am_m);
-  
   struct demod_am_s * am = & dem->am;
 
-  int input_rate = demod_get_input_rate(dem);
-  int output_rate = demod_get_output_rate(dem);
+  int input_rate = common->input_rate;
+  int output_rate = common->output_rate;
+
+  am->input_rate = input_rate;
+  am->output_rate = output_rate;
+  am->fixed = common->fixed_point;
+  am->filter = common->am_filter;
   
   float As = 60.0f;
   
   // first stage decimation factor to get sample rate to 400kHz
   am->r1 = (float) output_rate/ ((float) input_rate);
+
+  am->y_cap = _demod_max_output(dem->x_cap, am->r1);
   
-  // initialize multistage resampler
-  am->resamp1 = msresamp_crcf_create(am->r1, As);
+  if (am->fixed) {
+    // keep 8 bits of the gain the filter's averaging gives
+    am->qresamp1 = qresamp_create(am->r1, 0.8f, As, 32, 8, true, dem->x_cap);
+  }
+  else {
+    // initialize multistage resampler for what the FFT filter or the front
+    // end leave of the decimation
+    if ((am->fast = _demod_fast_create(am->filter, am->r1, As)) != NULL) {
+      am->resamp1 = filtercache_get_msresamp(am->r1 *
+					     ols_get_decim_factor(am->fast), As);
+
+      // a block can complete an FFT's worth of samples left from the last
+      am->y_cap = _demod_max_output(ols_get_max_output(am->fast, dem->x_cap) *
+				    ols_get_decim_factor(am->fast), am->r1);
+    }
+    else {
+      am->front = _demod_front_create(dem, am->r1);
+      am->resamp1 = filtercache_get_msresamp(_demod_front_residual(am->front,
+								     am->r1),
+					     As);
+    }
+  }
+
+  _demod_check_packet_cap(dem, am->y_cap);
 
   am->mi = 0.9f;
 
-  // create AM demodulator
-  float fc = 0.0f;
-  int suppressed = 0;
-  liquid_ampmodem_type t = LIQUID_AMPMODEM_DSB;
-  
-  am->dem = ampmodem_create(am->mi, fc, t, suppressed);
-  
-  pthread_mutex_unlock( & dem->am_m);
+  // envelope detector, carrier level tracked with a ~20 ms time constant
+  am->carrier = 0.0f;
+  am->alpha = 1.0f / (0.02f * (float) output_rate);
+  am->carrier_q = 0;
+  am->alpha_shift = (unsigned int) lroundf(log2f(0.02f * (float) output_rate));
 }
 
-void _demod_am_teardown(demod dem)
+/**
+ * Clears the filter and detector state a stage keeps, keeping the designed
+ * filters.
+ */
+static void _demod_am_flush(demod dem, demod_stage stage)
 {
-  pthread_mutex_lock( & dem->am_m);
-  
-  if (dem->am.dem) { ampmodem_destroy(dem->am.dem); }
-  if (dem->am.resamp1) { msresamp_crcf_destroy(dem->am.resamp1); }
-  
-  pthread_mutex_unlock( & dem->am_m);
+  switch (stage) {
+  case DEMOD_STAGE_FRONT:
+    if (dem->am.front) { decim_reset(dem->am.front); }
+    if (dem->am.fast) { ols_reset(dem->am.fast); }
+    if (dem->am.resamp1) { msresamp_crcf_reset(dem->am.resamp1); }
+    if (dem->am.qresamp1) { qresamp_reset(dem->am.qresamp1); }
+    break;
+  case DEMOD_STAGE_DETECT:
+    dem->am.carrier = 0.0f;
+    dem->am.carrier_q = 0;
+    break;
+  default: break;
+  }
 }
 
-void _demod_am(demod dem)
+void _demod_am_reset(demod dem)
 {
-  struct demod_am_s * am = & dem->am;
+  _demod_am_flush(dem, DEMOD_STAGE_FRONT);
+  _demod_am_flush(dem, DEMOD_STAGE_DETECT);
+}
 
-  pthread_mutex_lock( & dem->am_m);
+void _demod_am_teardown(demod dem)
+{
+  if (dem->am.front) { decim_destroy(dem->am.front); }
+  if (dem->am.fast) { ols_destroy(dem->am.fast); }
+  if (dem->am.resamp1) { filtercache_put_msresamp(dem->am.resamp1); }
+  if (dem->am.qresamp1) { qresamp_destroy(dem->am.qresamp1); }
+
+  dem->am.front = NULL;
+  dem->am.fast = NULL;
+  dem->am.resamp1 = NULL;
+  dem->am.qresamp1 = NULL;
+  dem->am.y_cap = 0;
+  dem->am.input_rate = -1;
+  dem->am.output_rate = -1;
+}
 
-  unsigned int nx = dem->input_len / 2;
-  unsigned int ny = ceil(am->r1 * (float) nx);
-  
-  float complex x[nx];
-  float complex y[ny];
+static unsigned int _demod_am_front(demod dem,
+				    const uint8_t * input,
+				    unsigned int nx,
+				    void * y)
+{
+  struct demod_am_s * am = & dem->am;
+  unsigned int ny;
 
-  unsigned int i;
-  
-  for (i = 0; i < nx; i++) {
-    x[i] = ((float) dem->input[2*i]) + ((float) dem->input[2*i+1])*_Complex_I;
+  if (am->fixed) {
+    qresamp_execute_cu8(am->qresamp1, input, nx, (int16_t *) y, & ny);
+    return ny;
   }
 
+  _demod_front_execute(dem, am->front, am->fast, input, & nx);
+
   // downsample
-  msresamp_crcf_execute(am->resamp1, x, nx, y, & ny);
-  
-  float t = 0.0f;
-  
-  for (i = 0; i < ny; i++) {
-    ampmodem_demodulate(am->dem, y[i], & t);
-    dem->output[i] = (int16_t) (am->mi * t / NF);
+  msresamp_crcf_execute(am->resamp1, dem->x, nx, (float complex *) y, & ny);
+
+  return ny;
+}
+
+static unsigned int _demod_am_detect(demod dem,
+				     const void * x,
+				     unsigned int n,
+				     void * y)
+{
+  struct demod_am_s * am = & dem->am;
+
+  // the integer detector applies the modulation index itself
+  if (am->fixed) {
+    detect_am_q15((const int16_t *) x, n, & am->carrier_q, am->alpha_shift,
+		  (int16_t) (am->mi * 32767.0f), (int16_t *) y);
   }
-  
-  dem->output_len =  ny;
-  
-  pthread_mutex_unlock( & dem->am_m);
+  else {
+    detect_am((const float complex *) x, n, & am->carrier, am->alpha,
+	      (float *) y);
+  }
+
+  return n;
+}
+
+static unsigned int _demod_am_audio(demod dem,
+				    const void * x,
+				    unsigned int n,
+				    int16_t * y)
+{
+  struct demod_am_s * am = & dem->am;
+
+  if (am->fixed) { memcpy(y, x, n * sizeof(int16_t)); }
+  else { convert_f_to_s16((const float *) x, y, n, am->mi / NF); }
+
+  return n;
 }
 
-void _demod_fm(demod dem);
-void _demod_fm_init(demod dem);
+void _demod_fm_init(demod dem, struct demod_common_s * common);
+void _demod_fm_reset(demod dem);
 void _demod_fm_teardown(demod dem);
 
-void _demod_fm_init(demod dem)
+void _demod_fm_init(demod dem, struct demod_common_s * common)
 {
   // make sure any previously allocated memory is freed
   _demod_fm_teardown(dem);
 
-  pthread_mutex_lock( & dem->fm_m);
-  
   struct demod_fm_s * fm = & dem->fm;
 
   fm->kf = 1.0f;
-  fm->dem = freqdem_create(fm->kf);
+  fm->prev = 1.0f;
   
-  int input_rate = demod_get_input_rate(dem);
-  int output_rate = demod_get_output_rate(dem);
+  int input_rate = common->input_rate;
+  int output_rate = common->output_rate;
+
+  fm->input_rate = input_rate;
+  fm->output_rate = output_rate;
+  fm->fixed = common->fixed_point;
+  fm->filter = common->fm_filter;
+  fm->phase = 0;
 
   // choose a multiple of the output rate
   float intermediate_rate = 4.0f * ((float) output_rate);
@@ -250,190 +774,692 @@ void _demod_fm_init(demod dem)
 
   // second stage, to get to final output rate (usually 48 kHz)
   fm->r2 = ((float) output_rate) / intermediate_rate;
+
+  fm->y_cap = _demod_max_output(dem->x_cap, fm->r1);
+  fm->z_cap = _demod_max_output(fm->y_cap, fm->r2);
+
+  if (fm->fixed) {
+    // same audio bandwidth as below, as a fraction of the output Nyquist
+    fm->qresamp1 = qresamp_create(fm->r1, 0.8f, As, 32, 8, true, dem->x_cap);
+    fm->qresamp2 = qresamp_create(fm->r2, 20e3 / (0.5f * output_rate), As, 32,
+				  15, false, fm->y_cap);
+
+    _demod_check_packet_cap(dem, fm->y_cap);
+
+    return;
+  }
   
-  // initialize multistage resampler
-  fm->resamp1 = msresamp_crcf_create(fm->r1, As);
+  // initialize multistage resampler for what the FFT filter or the front
+  // end leave of the decimation
+  if ((fm->fast = _demod_fast_create(fm->filter, fm->r1, As)) != NULL) {
+    fm->resamp1 = filtercache_get_msresamp(fm->r1 *
+					   ols_get_decim_factor(fm->fast), As);
+
+    // a block can complete an FFT's worth of samples left from the last
+    fm->y_cap = _demod_max_output(ols_get_max_output(fm->fast, dem->x_cap) *
+				  ols_get_decim_factor(fm->fast), fm->r1);
+    fm->z_cap = _demod_max_output(fm->y_cap, fm->r2);
+  }
+  else {
+    fm->front = _demod_front_create(dem, fm->r1);
+    fm->resamp1 = filtercache_get_msresamp(_demod_front_residual(fm->front,
+								   fm->r1),
+					   As);
+  }
+
+  _demod_check_packet_cap(dem, fm->y_cap);
 
   // initialize final resampler
   unsigned int h_len = 9;
   float bw = 20e3 / intermediate_rate;
   unsigned int npfb = 16;
 
-  fm->resamp2 = resamp_rrrf_create(fm->r2, h_len, bw, As, npfb);
+  fm->resamp2 = filtercache_get_resamp(fm->r2, h_len, bw, As, npfb);
 
-  pthread_mutex_unlock( & dem->fm_m);
+  fm->z = (float *) _demod_alloc(fm->z_cap * sizeof(float));
 }
 
-void _demod_fm_teardown(demod dem)
+/**
+ * Clears the filter and discriminator state a stage keeps, keeping the
+ * designed filters.
+ */
+static void _demod_fm_flush(demod dem, demod_stage stage)
 {
-  pthread_mutex_lock( & dem->fm_m);
-  
-  struct demod_fm_s * fm = & dem->fm;
-  
-  if (fm->dem) { freqdem_destroy(fm->dem); }
-  if (fm->resamp1) { msresamp_crcf_destroy(fm->resamp1); }
-  if (fm->resamp2) { resamp_rrrf_destroy(fm->resamp2); }
-  
-  pthread_mutex_unlock( & dem->fm_m);
+  switch (stage) {
+  case DEMOD_STAGE_FRONT:
+    if (dem->fm.front) { decim_reset(dem->fm.front); }
+    if (dem->fm.fast) { ols_reset(dem->fm.fast); }
+    if (dem->fm.resamp1) { msresamp_crcf_reset(dem->fm.resamp1); }
+    if (dem->fm.qresamp1) { qresamp_reset(dem->fm.qresamp1); }
+    break;
+  case DEMOD_STAGE_DETECT:
+    dem->fm.prev = 1.0f;
+    dem->fm.phase = 0;
+    break;
+  case DEMOD_STAGE_AUDIO:
+    if (dem->fm.resamp2) { resamp_rrrf_reset(dem->fm.resamp2); }
+    if (dem->fm.qresamp2) { qresamp_reset(dem->fm.qresamp2); }
+    break;
+  default: break;
+  }
 }
 
-void _demod_fm(demod dem)
+void _demod_fm_reset(demod dem)
 {
-  pthread_mutex_lock( & dem->fm_m);
+  _demod_fm_flush(dem, DEMOD_STAGE_FRONT);
+  _demod_fm_flush(dem, DEMOD_STAGE_DETECT);
+  _demod_fm_flush(dem, DEMOD_STAGE_AUDIO);
+}
 
+void _demod_fm_teardown(demod dem)
+{
   struct demod_fm_s * fm = & dem->fm;
   
-  unsigned int nx = dem->input_len / 2;
-  unsigned int ny = ceil(fm->r1 * (float) nx);
-  unsigned int nz = ceil(fm->r2 * (float) ny);
-  
-  float complex x[nx];
-  float complex y[ny];
-  float z[nz];
+  if (fm->front) { decim_destroy(fm->front); }
+  if (fm->fast) { ols_destroy(fm->fast); }
+  if (fm->resamp1) { filtercache_put_msresamp(fm->resamp1); }
+  if (fm->resamp2) { filtercache_put_resamp(fm->resamp2); }
+  if (fm->qresamp1) { qresamp_destroy(fm->qresamp1); }
+  if (fm->qresamp2) { qresamp_destroy(fm->qresamp2); }
 
-  unsigned int i, j;
-  unsigned int num_written = 0;
-  
-  for (i = 0; i < nx; i++) {
-    x[i] = ((float) dem->input[2*i]) + ((float) dem->input[2*i+1])*_Complex_I;
-  }
+  free(fm->z);
 
-  // downsample to intermediate rate
-  msresamp_crcf_execute(fm->resamp1, x, nx, y, & ny);
-  
-  float t = 0.0f;
+  fm->front = NULL;
+  fm->fast = NULL;
+  fm->resamp1 = NULL;
+  fm->resamp2 = NULL;
+  fm->qresamp1 = NULL;
+  fm->qresamp2 = NULL;
+  fm->z = NULL;
+  fm->y_cap = 0;
+  fm->z_cap = 0;
+  fm->input_rate = -1;
+  fm->output_rate = -1;
+}
 
-  for (i = 0, j = 0; i < ny; i++, j += num_written) {
-    freqdem_demodulate(fm->dem, y[i], & t);
-    
-    // downsample to output rate
-    resamp_rrrf_execute(fm->resamp2, t, & z[j], & num_written);
-  }
-  
-  dem->output_len = (int) j;
+/**
+ * Runs a whole block through a resamp_rrrf (liquid has no block call for it
+ * here), writing y contiguously. *ny is the number of samples written.
+ */
+static void _demod_resamp_block(resamp_rrrf q,
+				float * x,
+				unsigned int nx,
+				float * y,
+				unsigned int * ny)
+{
+  unsigned int i, j, num_written;
 
-  for (i = 0; i < dem->output_len; i++) {
-    dem->output[i] = (int16_t) (fm->kf * z[i] * 32768.0f);
+  for (i = 0, j = 0; i < nx; i++, j += num_written) {
+    resamp_rrrf_execute(q, x[i], & y[j], & num_written);
   }
 
-  pthread_mutex_unlock( & dem->fm_m);
+  * ny = j;
 }
 
-void _demod_measure_snr(demod dem)
+static unsigned int _demod_fm_front(demod dem,
+				    const uint8_t * input,
+				    unsigned int nx,
+				    void * y)
 {
-  // power
-  float S = 0.0f, N = 0.0f;
-  
-  int input_rate = demod_get_input_rate(dem);
-  
-  int step = 10;
-  int i, j;
+  struct demod_fm_s * fm = & dem->fm;
+  unsigned int ny;
 
-  // effective sample rate
-  float fs = ((float) input_rate) / step;
-  
-  // don't need every sample; reduce, pick a power of two
-  int n = 1 << (int) ceilf(log2f(((float) dem->input_len) / step));
+  if (fm->fixed) {
+    qresamp_execute_cu8(fm->qresamp1, input, nx, (int16_t *) y, & ny);
+    return ny;
+  }
 
-  // one-sided bandwidth of the signal
-  float bw = 250.0f;
+  _demod_front_execute(dem, fm->front, fm->fast, input, & nx);
 
-  // number of bins occupied by the signal, per-side
-  int num_bins = (int) (bw / fs * n);
-  
-  float complex x[n];
-  float complex y[n];
-  
-  int flags = 0; // ignored
-  
-  fftplan q = fft_create_plan(n, x, y, LIQUID_FFT_FORWARD, flags);
+  // downsample to intermediate rate
+  msresamp_crcf_execute(fm->resamp1, dem->x, nx, (float complex *) y, & ny);
+
+  return ny;
+}
+
+static unsigned int _demod_fm_detect(demod dem,
+				     const void * x,
+				     unsigned int n,
+				     void * y)
+{
+  struct demod_fm_s * fm = & dem->fm;
+
+  // discriminate, scaled to match freqdem (kf = 1)
+  if (fm->fixed) {
+    detect_fm_q15((const int16_t *) x, n, & fm->phase, (int16_t *) y); }
+  else {
+    detect_fm((const float complex *) x, n, & fm->prev,
+	      1.0f / (2.0f * M_PI * fm->kf), (float *) y);
+  }
+
+  return n;
+}
+
+static unsigned int _demod_fm_audio(demod dem,
+				    const void * x,
+				    unsigned int n,
+				    int16_t * y)
+{
+  struct demod_fm_s * fm = & dem->fm;
+  unsigned int nz;
+
+  // downsample to output rate
+  if (fm->fixed) {
+    qresamp_execute_s16(fm->qresamp2, (const int16_t *) x, n, y, & nz);
+    return nz;
+  }
+
+  _demod_resamp_block(fm->resamp2, (float *) x, n, fm->z, & nz);
+
+  convert_f_to_s16(fm->z, y, nz, fm->kf * 32768.0f);
+
+  return nz;
+}
+
+static void _demod_flush(demod dem, demod_mode mode, demod_stage stage)
+{
+  switch (mode) {
+  case DEMOD_FM:
+    _demod_fm_flush(dem, stage);
+    break;
+  case DEMOD_AM:
+    _demod_am_flush(dem, stage);
+    break;
+  default: break;
+  }
+}
+
+/**
+ * Gated squelch, decided for each block from the input SNR (the spectrum
+ * tracks the noise floor off the critical path): it opens at
+ * SQUELCH_THRESHOLD, and closes once the SNR has been SQUELCH_HYSTERESIS
+ * below that for SQUELCH_HOLD blocks. Returns whether it's open; *opened is
+ * set if it's only just opened.
+ *
+ * Nothing carries over from another tuning: it starts closed, and stays
+ * closed until the metrics stage has reset the spectrum for the block's tag.
+ */
+static bool _demod_squelch_update(demod dem, uint32_t tag, bool * opened)
+{
+  struct demod_squelch_s * sq = & dem->squelch;
+  float snr = 0.0f;
+
+  * opened = false;
+
+  if (tag != sq->tag) {
+    sq->tag = tag;
+    sq->open = false;
+    sq->hold = 0;
+  }
+
+  // the previous tuning's noise floor doesn't count either
+  if (atomic_load( & dem->tune_gen) == tag) {
+    snr = spectrum_get_snr(dem->spectrum); }
+
+  if (snr >= SQUELCH_THRESHOLD) {
+    * opened = ! sq->open;
+    sq->open = true;
+    sq->hold = SQUELCH_HOLD;
+  }
+  else if (snr >= SQUELCH_THRESHOLD - SQUELCH_HYSTERESIS) {
+    sq->hold = SQUELCH_HOLD;
+  }
+  else if (sq->hold > 0) {
+    sq->hold--;
+  }
+  else {
+    sq->open = false;
+  }
+
+  return sq->open;
+}
+
+// output samples nx input samples stand for while squelched
+static unsigned int _demod_squelch_silence(demod dem, unsigned int nx)
+{
+  double n = dem->squelch.owed + (double) nx *
+    dem->applied.output_rate / (double) dem->applied.input_rate;
+
+  dem->squelch.owed = n - floor(n);
+
+  return (unsigned int) n;
+}
+
+/**
+ * Front end stage: takes raw blocks to the mode's intermediate rate, and
+ * hands a copy of the blocks the spectra analyze to the metrics stage (and
+ * of every block to the channel monitor, if it's on).
+ */
+static void * _demod_front_fn(void * ctx)
+{
+  demod dem = (demod) ctx;
+
+  struct ring_block_s * block, * slot;
+  struct demod_packet_s * packet;
+  demod_mode mode;
+  bool retuned, opened;
+  double t;
 
-  // fill with data, zero padding
-  for (i = 0, j = 0; i < n; i++, j += step) {
-    if (j >= dem->input_len) {
-      x[i] = 0.0f;
+  while ((block = _demod_queue_wait(dem, & dem->input)) != NULL) {
+    if ((slot = _demod_queue_acquire(dem, & dem->decimated)) == NULL) {
+      break; }
+
+    t = _demod_thread_time();
+
+    // the first block from a new tuning is measured straight away
+    if ((retuned = block->tag != dem->raw_tag)) {
+      dem->raw_tag = block->tag;
+      dem->raw_count = 0;
+    }
+
+    // the spectrum gets a copy of the blocks it'll analyze, unless it's
+    // fallen behind
+    if (dem->raw_count++ % atomic_load( & dem->raw_cadence) == 0 &&
+	ring_push(dem->raw.r, block->data, block->size, block->tag)) {
+      safe_cond_signal( & dem->raw.ready, & dem->raw.ready_m);
+    }
+
+    if (atomic_load( & dem->channels_enabled) &&
+	ring_push(dem->band.r, block->data, block->size, block->tag)) {
+      safe_cond_signal( & dem->band.ready, & dem->band.ready_m);
     }
+
+    packet = (struct demod_packet_s *) slot->data;
+
+    pthread_mutex_lock( & dem->stage_m[DEMOD_STAGE_FRONT]);
+
+    mode = dem->applied.mode;
+    packet->gen = dem->gen;
+
+    // the cut's made at the first sample from a new tuning, however it was
+    // retuned (the scanner doesn't wait for the stages to be reset)
+    packet->flush = retuned && dem->applied.reset_on_retune;
+    opened = false;
+
+    // while squelched nothing downstream runs, it's just told how much
+    // silence there is
+    packet->silent = mode != DEMOD_NONE &&
+      ! _demod_squelch_update(dem, block->tag, & opened);
+    packet->flush = packet->flush || opened;
+
+    if (packet->flush) { _demod_flush(dem, mode, DEMOD_STAGE_FRONT); }
+
+    if (packet->silent) {
+      packet->n = _demod_squelch_silence(dem, block->size / 2); }
     else {
-      x[i] = ((float) dem->input[i]) + ((float) dem->input[i+1])*_Complex_I;
-      x[i] = NF * x[i];
+      switch (mode) {
+      case DEMOD_FM:
+	packet->n = _demod_fm_front(dem, (uint8_t *) block->data,
+				    block->size / 2, DEMOD_PACKET_DATA(packet));
+	break;
+      case DEMOD_AM:
+	packet->n = _demod_am_front(dem, (uint8_t *) block->data,
+				    block->size / 2, DEMOD_PACKET_DATA(packet));
+	break;
+      default:
+	packet->n = 0;
+	break;
+      }
     }
+
+    pthread_mutex_unlock( & dem->stage_m[DEMOD_STAGE_FRONT]);
+
+    // done with the input, hand the slot back to the producer
+    _demod_queue_release( & dem->input);
+
+    packet->busy = (float) (_demod_thread_time() - t);
+    _demod_queue_commit( & dem->decimated);
   }
-  
-  fft_execute(q);
 
-  // compute signal power, noise floor
-  for (i = 0; i < n; i++) {
-    y[i] = cabs(y[i]);
-    
-    if (i < num_bins || i > (n - num_bins)) {
-      S += y[i];
+  return NULL;
+}
+
+/**
+ * Detector stage: demodulates the front end's output.
+ */
+static void * _demod_detect_fn(void * ctx)
+{
+  demod dem = (demod) ctx;
+
+  struct ring_block_s * block, * slot;
+  struct demod_packet_s * in, * out;
+  bool current;
+  double t;
+
+  while ((block = _demod_queue_wait(dem, & dem->decimated)) != NULL) {
+    if ((slot = _demod_queue_acquire(dem, & dem->detected)) == NULL) {
+      break; }
+
+    t = _demod_thread_time();
+
+    in = (struct demod_packet_s *) block->data;
+    out = (struct demod_packet_s *) slot->data;
+
+    pthread_mutex_lock( & dem->stage_m[DEMOD_STAGE_DETECT]);
+
+    // blocks from before a reconfiguration are dropped
+    if ((current = in->gen == dem->gen)) {
+      if (in->flush) {
+	_demod_flush(dem, dem->applied.mode, DEMOD_STAGE_DETECT); }
+
+      if (in->silent) { out->n = in->n; }
+      else {
+	switch (dem->applied.mode) {
+	case DEMOD_FM:
+	  out->n = _demod_fm_detect(dem, DEMOD_PACKET_DATA(in), in->n,
+				    DEMOD_PACKET_DATA(out));
+	  break;
+	case DEMOD_AM:
+	  out->n = _demod_am_detect(dem, DEMOD_PACKET_DATA(in), in->n,
+				    DEMOD_PACKET_DATA(out));
+	  break;
+	default:
+	  out->n = 0;
+	  break;
+	}
+      }
+
+      out->gen = in->gen;
+      out->silent = in->silent;
+      out->flush = in->flush;
     }
-    else {
-      N += y[i];
+
+    pthread_mutex_unlock( & dem->stage_m[DEMOD_STAGE_DETECT]);
+
+    out->busy = fmaxf(in->busy, (float) (_demod_thread_time() - t));
+
+    _demod_queue_release( & dem->decimated);
+
+    if (current) { _demod_queue_commit( & dem->detected); }
+  }
+
+  return NULL;
+}
+
+/**
+ * Takes a slot to write the next output block into (the ring's left alone
+ * until it's published). Returns NULL, and skips the block's sequence
+ * number, if readers are holding every slot.
+ */
+static struct demod_slot_s * _demod_output_claim(demod dem)
+{
+  struct demod_slot_s * slot = NULL;
+  int i;
+
+  pthread_mutex_lock( & dem->output_m);
+
+  for (i = 0; i < DEMOD_OUTPUT_SLOTS; i++) {
+    if ( ! dem->output_slots[i].in_ring && dem->output_slots[i].refs == 0) {
+      slot = & dem->output_slots[i];
+      slot->refs = 1;
+      break;
     }
   }
 
-  // average
-  S = S / (2 * num_bins);
-  N = N / (n - (2 * num_bins));
+  if (slot == NULL) { dem->output_seq++; }
 
-  // compute SNR (in dB)
-  dem->metrics.snr = 20*log10f(S / N);
+  pthread_mutex_unlock( & dem->output_m);
+
+  return slot;
+}
 
-  fft_destroy_plan(q);
-} 
+/**
+ * Puts a claimed slot in the ring as the next block, evicting the oldest
+ * along with the sequence number it's counted by, so readers never find a
+ * hole in the last DEMOD_OUTPUT_DEPTH.
+ */
+static void _demod_output_publish(demod dem,
+				  struct demod_slot_s * slot,
+				  int len,
+				  bool silent)
+{
+  struct demod_slot_s ** entry;
+  struct timespec time;
 
-static void * _demod_thread_fn(void * ctx)
+  clock_gettime(CLOCK_REALTIME, & time);
+
+  pthread_mutex_lock( & dem->output_m);
+
+  slot->block.seq = dem->output_seq++;
+  slot->block.time = time;
+  slot->block.len = len;
+  slot->block.silent = silent;
+
+  entry = & dem->output_index[slot->block.seq % DEMOD_OUTPUT_DEPTH];
+
+  if (* entry != NULL) { (* entry)->in_ring = false; }
+
+  * entry = slot;
+  slot->in_ring = true;
+  slot->refs--;
+
+  pthread_cond_broadcast( & dem->output_ready);
+  pthread_mutex_unlock( & dem->output_m);
+}
+
+/**
+ * Audio stage: resamples and quantizes into the next output block (or just
+ * passes on the silence) and publishes it to the readers.
+ */
+static void * _demod_audio_fn(void * ctx)
 {
   demod dem = (demod) ctx;
-  
-  clock_t t1, t2;
-  float dt;
 
-  int i;
+  struct ring_block_s * block;
+  struct demod_packet_s * in;
+  struct demod_slot_s * slot;
+  float busy;
+  int n = 0;
+  double t;
+
+  while ((block = _demod_queue_wait(dem, & dem->detected)) != NULL) {
+    t = _demod_thread_time();
+
+    in = (struct demod_packet_s *) block->data;
+    slot = NULL;
+
+    pthread_mutex_lock( & dem->stage_m[DEMOD_STAGE_AUDIO]);
+
+    // the readers are never waited for, if they're holding every slot the
+    // block is lost (and shows up as skipped); nor is anything published
+    // while another channel's being listened to
+    if (in->gen == dem->gen && ! atomic_load( & dem->listening) &&
+	(slot = _demod_output_claim(dem)) != NULL) {
+      if (in->flush) {
+	_demod_flush(dem, dem->applied.mode, DEMOD_STAGE_AUDIO); }
+
+      if (in->silent) { n = in->n; }
+      else {
+	switch (dem->applied.mode) {
+	case DEMOD_FM:
+	  n = _demod_fm_audio(dem, DEMOD_PACKET_DATA(in), in->n,
+			      slot->block.data);
+	  break;
+	case DEMOD_AM:
+	  n = _demod_am_audio(dem, DEMOD_PACKET_DATA(in), in->n,
+			      slot->block.data);
+	  break;
+	default:
+	  n = 0;
+	  break;
+	}
+      }
+    }
 
-  while (_demod_get_state(dem) != DEMOD_EXITING) {
-    safe_cond_wait( & dem->input_ready, & dem->input_ready_m);
+    pthread_mutex_unlock( & dem->stage_m[DEMOD_STAGE_AUDIO]);
 
-    t1 = clock();
-    
-    pthread_mutex_lock( & dem->metrics_m);    
-    pthread_mutex_lock( & dem->input_m);
-    pthread_mutex_lock( & dem->output_m);
+    busy = fmaxf(in->busy, (float) (_demod_thread_time() - t));
 
-    _demod_measure_snr(dem);
+    _demod_queue_release( & dem->detected);
 
-    switch (demod_get_mode(dem)) {
-    case DEMOD_FM:
-      _demod_fm(dem);
-      break;
-    case DEMOD_AM:
-      _demod_am(dem);
-      break;
-    default: break;
+    if (slot == NULL) { continue; }
+
+    // the pipeline runs as fast as its busiest stage (when it's running)
+    if ( ! in->silent) {
+      pthread_mutex_lock( & dem->metrics_m);
+      dem->metrics.throughput = ((float) n) / busy;
+      pthread_mutex_unlock( & dem->metrics_m);
     }
 
-    // rudimentary squelch
-    if (dem->metrics.snr < SQUELCH_THRESHOLD) {
-      for (i = 0; i < dem->output_len; i++) { dem->output[i] = 0; } }
+    _demod_output_publish(dem, slot, n, in->silent);
+  }
 
-    pthread_mutex_unlock( & dem->input_m);
-    pthread_mutex_unlock( & dem->output_m);
+  return NULL;
+}
 
-    t2 = clock();
-    dt = ((float) t2 - (float) t1) / CLOCKS_PER_SEC;
-    
-    dem->metrics.throughput = ((float) dem->output_len) / dt;
-    
-    pthread_mutex_unlock( & dem->metrics_m);
-    
-    // signal that we've got new output
-    safe_cond_signal( & dem->output_ready, & dem->output_ready_m);
+/**
+ * Metrics stage: feeds the spectrum (which drives SNR and the squelch) off
+ * the critical path.
+ */
+static void * _demod_metrics_fn(void * ctx)
+{
+  demod dem = (demod) ctx;
+
+  struct ring_block_s * block;
+
+  while ((block = _demod_queue_wait(dem, & dem->raw)) != NULL) {
+    pthread_mutex_lock( & dem->stage_m[DEMOD_STAGE_METRICS]);
+
+    // the first samples from a new tuning, nothing before them counts (the
+    // squelch waits on tune_gen before it trusts the SNR again)
+    if (block->tag != atomic_load( & dem->tune_gen)) {
+      spectrum_reset(dem->spectrum);
+      spectrum_reset(dem->display);
+      atomic_store( & dem->tune_gen, block->tag);
+    }
+
+    atomic_store( & dem->block_len, block->size / 2);
+
+    // only every few blocks are actually analyzed
+    spectrum_execute(dem->spectrum, (uint8_t *) block->data, block->size / 2,
+		     (float) demod_get_input_rate(dem));
+
+    if (atomic_load( & dem->display_enabled)) {
+      spectrum_execute(dem->display, (uint8_t *) block->data, block->size / 2,
+		       (float) demod_get_input_rate(dem));
+    }
+
+    pthread_mutex_unlock( & dem->stage_m[DEMOD_STAGE_METRICS]);
+
+    _demod_queue_release( & dem->raw);
   }
-  
+
   return NULL;
 }
 
+/**
+ * Demodulates channel k of the monitor for listening, instead of whichever
+ * was before (-1 for none). Call with channels_m held.
+ */
+static void _demod_listen_select(demod dem, int k)
+{
+  if (k == dem->listen_k) { return; }
+
+  if (dem->listen_k >= 0) {
+    channelizer_set_enabled(dem->channels, dem->listen_k, false); }
+  if (k >= 0) { channelizer_set_enabled(dem->channels, k, true); }
+
+  dem->listen_k = k;
+}
+
+/**
+ * Channels stage: measures the power in every FM channel of the capture, and
+ * demodulates the one being listened to (if it's in the band), publishing
+ * its audio in place of the tuned station's. It's fed a copy of every
+ * block, so none of it holds up the other stages.
+ */
+static void * _demod_channels_fn(void * ctx)
+{
+  demod dem = (demod) ctx;
+
+  struct ring_block_s * block;
+  struct demod_slot_s * slot;
+  int16_t * audio;
+  int k, n;
+
+  while ((block = _demod_queue_wait(dem, & dem->band)) != NULL) {
+    pthread_mutex_lock( & dem->stage_m[DEMOD_STAGE_CHANNELS]);
+    pthread_mutex_lock( & dem->channels_m);
+
+    slot = NULL;
+    k = -1;
+    n = 0;
+
+    if (dem->channels != NULL) {
+      // samples from another tuning don't follow on from the last block, and
+      // powers measured there (or in another mode) mean nothing here
+      if (dem->applied.mode != DEMOD_FM || block->tag != dem->channels_tag) {
+	channelizer_reset(dem->channels);
+	dem->channels_tag = block->tag;
+      }
+
+      // the demod's told the new frequency before the tuner is (see
+      // demod_set_center_freq), so it's already set when its first samples
+      // get here
+      if ( ! channelizer_is_measured(dem->channels)) {
+	dem->channels_fc = demod_get_center_freq(dem); }
+
+      if (dem->applied.mode == DEMOD_FM && dem->listen_fc > 0) {
+	k = channelizer_lookup_channel(dem->channels, (int) dem->listen_fc -
+				       (int) dem->channels_fc);
+      }
+
+      _demod_listen_select(dem, k);
+
+      if (dem->applied.mode == DEMOD_FM) {
+	channelizer_execute(dem->channels, (uint8_t *) block->data,
+			    block->size / 2);
+      }
+
+      if (k >= 0) { n = channelizer_get_output(dem->channels, k, & audio); }
+
+      // same as the audio stage, if readers are holding every slot the block
+      // is lost
+      if (n > 0 && (slot = _demod_output_claim(dem)) != NULL) {
+	memcpy(slot->block.data, audio, n * sizeof(int16_t)); }
+    }
+
+    atomic_store( & dem->listening, k >= 0);
+
+    pthread_mutex_unlock( & dem->channels_m);
+    pthread_mutex_unlock( & dem->stage_m[DEMOD_STAGE_CHANNELS]);
+
+    _demod_queue_release( & dem->band);
+
+    if (slot != NULL) { _demod_output_publish(dem, slot, n, false); }
+  }
+
+  return NULL;
+}
+
+static void * (* const _demod_stage_fns[DEMOD_NUM_STAGES])(void *) = {
+  [DEMOD_STAGE_FRONT] = _demod_front_fn,
+  [DEMOD_STAGE_DETECT] = _demod_detect_fn,
+  [DEMOD_STAGE_AUDIO] = _demod_audio_fn,
+  [DEMOD_STAGE_METRICS] = _demod_metrics_fn,
+  [DEMOD_STAGE_CHANNELS] = _demod_channels_fn
+};
+
+static void _demod_start_stages(demod dem)
+{
+  cpu_set_t cpus;
+  int i;
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) {
+    pthread_create( & dem->threads[i], NULL, _demod_stage_fns[i],
+		    (void *) dem);
+
+    if (dem->cpus[i] < 0) { continue; }
+
+    CPU_ZERO( & cpus);
+    CPU_SET(dem->cpus[i], & cpus);
+
+    // not fatal, the stage just runs wherever the scheduler puts it
+    if (pthread_setaffinity_np(dem->threads[i], sizeof(cpu_set_t), & cpus)) {
+      ERROR("Failed to pin demod stage %d to CPU %d.\n", i, dem->cpus[i]); }
+  }
+}
+
 demod demod_create()
 {
   demod dem = (demod) malloc(sizeof(struct demod_s));
@@ -441,50 +1467,145 @@ demod demod_create()
   struct demod_common_s * common = & dem->common;
   struct demod_am_s * am = & dem->am;
   struct demod_fm_s * fm = & dem->fm;
+
+  int i;
   
   // initialize common parameters
   common->mode = DEMOD_NONE;
   common->center_freq = -1;
   common->input_rate = -1;
   common->output_rate = -1;
+  common->reset_on_retune = true;
+  common->fixed_point = DEMOD_FIXED_POINT;
+  common->fm_filter = DEMOD_FILTER_AUTO;
+  common->am_filter = DEMOD_FILTER_AUTO;
+
+  dem->applied = * common;
 
   // initialize FM parameters
-  fm->dem = NULL;
+  fm->input_rate = -1;
+  fm->output_rate = -1;
+  fm->prev = 1.0f;
   fm->resamp1 = NULL;
   fm->resamp2 = NULL;
   fm->r1 = 0.0f;
   fm->r2 = 0.0f;
+  fm->z = NULL;
+  fm->y_cap = 0;
+  fm->z_cap = 0;
+  fm->fixed = false;
+  fm->filter = DEMOD_FILTER_AUTO;
+  fm->front = NULL;
+  fm->fast = NULL;
+  fm->qresamp1 = NULL;
+  fm->qresamp2 = NULL;
+  fm->phase = 0;
 
   // initialize AM parameters
-  am->dem = NULL;
+  am->input_rate = -1;
+  am->output_rate = -1;
   am->resamp1 = NULL;
+  am->carrier = 0.0f;
+  am->alpha = 0.0f;
   am->r1 = 0.0f;
+  am->y_cap = 0;
+  am->fixed = false;
+  am->filter = DEMOD_FILTER_AUTO;
+  am->front = NULL;
+  am->fast = NULL;
+  am->qresamp1 = NULL;
+  am->carrier_q = 0;
+  am->alpha_shift = 0;
     
   // initialize buffers
-  dem->input_len = 0;
-  dem->output_len = 0;
+  dem->x_cap = RTL_MAX_BUFFER_LENGTH / 2;
+  dem->x = (float complex *) _demod_alloc(dem->x_cap * sizeof(float complex));
+  dem->input_blocking = false;
+
+  dem->output_headroom = 0;
+  dem->output_tailroom = 0;
+
+  for (i = 0; i < DEMOD_OUTPUT_SLOTS; i++) {
+    struct demod_slot_s * slot = & dem->output_slots[i];
+
+    slot->mem = NULL;
+    slot->block.len = 0;
+    slot->block.silent = false;
+    slot->refs = 0;
+    slot->in_ring = false;
+  }
+
+  _demod_alloc_output(dem);
+
+  for (i = 0; i < DEMOD_OUTPUT_DEPTH; i++) { dem->output_index[i] = NULL; }
+
+  dem->output_seq = 0;
+
+  dem->squelch.open = false;
+  dem->squelch.hold = 0;
+  dem->squelch.owed = 0.0;
+  dem->squelch.tag = 0;
+
+  _demod_queue_init( & dem->input, DEMOD_INPUT_DEPTH,
+		     RTL_MAX_BUFFER_LENGTH * sizeof(uint8_t));
+  _demod_queue_init( & dem->raw, DEMOD_STAGE_DEPTH,
+		     RTL_MAX_BUFFER_LENGTH * sizeof(uint8_t));
+  _demod_queue_init( & dem->band, DEMOD_STAGE_DEPTH,
+		     RTL_MAX_BUFFER_LENGTH * sizeof(uint8_t));
+  _demod_queue_init( & dem->decimated, DEMOD_STAGE_DEPTH, CACHE_LINE_SIZE +
+		     _demod_packet_cap(dem) * sizeof(float complex));
+  _demod_queue_init( & dem->detected, DEMOD_STAGE_DEPTH, CACHE_LINE_SIZE +
+		     _demod_packet_cap(dem) * sizeof(float));
 
   // initialize operational state
   dem->state = DEMOD_HALTED;
+  dem->gen = 0;
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) {
+    dem->cpus[i] = -1;
+    pthread_mutex_init( & dem->stage_m[i], NULL);
+  }
   
   struct demod_metrics_s * metrics = & dem->metrics;
   
   // initialize metrics
-  metrics->snr = 0.0f;
   metrics->throughput = 0.0f;
 
-  pthread_mutex_init( & dem->common_m, NULL);
-  pthread_mutex_init( & dem->am_m, NULL);
-  pthread_mutex_init( & dem->fm_m, NULL);
-  
-  pthread_mutex_init( & dem->input_m, NULL);
-  pthread_cond_init( & dem->input_ready, NULL);
-  pthread_mutex_init( & dem->input_ready_m, NULL);
+  dem->spectrum = spectrum_create(DEMOD_SPECTRUM_SIZE,
+				  DEMOD_SPECTRUM_SEGMENTS,
+				  SPECTRUM_WINDOW_HANN);
+  spectrum_set_step(dem->spectrum, DEMOD_SPECTRUM_STEP);
+  spectrum_set_signal_bandwidth(dem->spectrum, DEMOD_SPECTRUM_SIGNAL_BW);
+  atomic_init( & dem->tune_gen, 0);
+
+  atomic_init( & dem->raw_cadence, DEMOD_SPECTRUM_CADENCE);
+  dem->raw_count = 0;
+  dem->raw_tag = 0;
+
+  dem->display = spectrum_create(DEMOD_SPECTRUM_SIZE,
+				 DEMOD_SPECTRUM_SEGMENTS,
+				 SPECTRUM_WINDOW_HANN);
+  spectrum_set_cadence(dem->display,
+		       DEMOD_DISPLAY_CADENCE / DEMOD_SPECTRUM_CADENCE);
+  atomic_init( & dem->display_enabled, false);
+  atomic_init( & dem->block_len, 0);
+
+  dem->channels = NULL;
+  atomic_init( & dem->channels_enabled, false);
+  dem->channels_tag = 0;
+  dem->channels_fc = 0;
+
+  dem->listen_fc = 0;
+  dem->listen_k = -1;
+  atomic_init( & dem->listening, false);
+
+  seqlock_init( & dem->common_lock);
   
   pthread_mutex_init( & dem->output_m, NULL);
   pthread_cond_init( & dem->output_ready, NULL);
-  pthread_mutex_init( & dem->output_ready_m, NULL);
   
+  pthread_mutex_init( & dem->metrics_m, NULL);
+  pthread_mutex_init( & dem->channels_m, NULL);
   pthread_mutex_init( & dem->state_m, NULL);
   
   return dem;
@@ -492,6 +1613,8 @@ demod demod_create()
 
 void demod_destroy(demod dem)
 {
+  int i;
+
   DEBUG("Destroying demod...\n");
   
   if (_demod_get_state(dem) != DEMOD_EXITING) { demod_exit(dem); }
@@ -499,28 +1622,58 @@ void demod_destroy(demod dem)
   _demod_am_teardown(dem);
   _demod_fm_teardown(dem);
   
-  pthread_mutex_destroy( & dem->common_m);
-  pthread_mutex_destroy( & dem->am_m);  
-  pthread_mutex_destroy( & dem->fm_m);
+  seqlock_destroy( & dem->common_lock);
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) {
+    pthread_mutex_destroy( & dem->stage_m[i]); }
 
-  pthread_mutex_destroy( & dem->input_m);
-  pthread_cond_destroy( & dem->input_ready);
-  pthread_mutex_destroy( & dem->input_ready_m);
+  _demod_queue_destroy( & dem->input);
+  _demod_queue_destroy( & dem->raw);
+  _demod_queue_destroy( & dem->band);
+  _demod_queue_destroy( & dem->decimated);
+  _demod_queue_destroy( & dem->detected);
+  free(dem->x);
   
   pthread_mutex_destroy( & dem->output_m);  
   pthread_cond_destroy( & dem->output_ready);  
-  pthread_mutex_destroy( & dem->output_ready_m);
+
+  for (i = 0; i < DEMOD_OUTPUT_SLOTS; i++) { free(dem->output_slots[i].mem); }
   
+  pthread_mutex_destroy( & dem->metrics_m);
+  pthread_mutex_destroy( & dem->channels_m);
   pthread_mutex_destroy( & dem->state_m);
+
+  spectrum_destroy(dem->spectrum);
+  spectrum_destroy(dem->display);
+
+  if (dem->channels != NULL) { channelizer_destroy(dem->channels); }
   
   free(dem);
 }
 
 void demod_exit(demod dem)
 {
+  bool running = _demod_get_state(dem) == DEMOD_RUNNING;
+  int i;
+
   _demod_set_state(dem, DEMOD_EXITING);
-  
-  pthread_join(dem->thread, NULL);
+
+  // wake the stages wherever they're waiting, and a producer in case it's
+  // waiting for room
+  _demod_queue_wake( & dem->input);
+  _demod_queue_wake( & dem->raw);
+  _demod_queue_wake( & dem->band);
+  _demod_queue_wake( & dem->decimated);
+  _demod_queue_wake( & dem->detected);
+
+  // and any readers waiting for output
+  pthread_mutex_lock( & dem->output_m);
+  pthread_cond_broadcast( & dem->output_ready);
+  pthread_mutex_unlock( & dem->output_m);
+
+  if ( ! running) { return; }
+
+  for (i = 0; i < DEMOD_NUM_STAGES; i++) { pthread_join(dem->threads[i], NULL); }
 }
 
 /**
@@ -529,37 +1682,170 @@ void demod_exit(demod dem)
  */
 void demod_execute(demod dem)
 {
-  pthread_mutex_lock( & dem->metrics_m);
+  struct demod_common_s common;
+
+  _demod_get_common(dem, & common);
+
+  bool mode_changed = common.mode != dem->applied.mode;
+  bool freq_changed = common.center_freq != dem->applied.center_freq;
+  bool rate_changed = common.input_rate != dem->applied.input_rate ||
+    common.output_rate != dem->applied.output_rate;
+
+  // only the parts affected by what changed are rebuilt; filters are only
+  // redesigned for a new rate, a retune at most clears their state
+  if (mode_changed || freq_changed || rate_changed) {
+    pthread_mutex_lock( & dem->metrics_m);
   
-  // reset metrics  
-  dem->metrics.snr = 0.0f;
-  dem->metrics.throughput = 0.0f;
+    // reset metrics  
+    dem->metrics.throughput = 0.0f;
   
-  pthread_mutex_unlock( & dem->metrics_m);
+    pthread_mutex_unlock( & dem->metrics_m);
+
+    spectrum_reset(dem->spectrum);
+  }
+
+  bool reset = mode_changed || (freq_changed && common.reset_on_retune);
+  bool rebuilt = false;
 
-  switch (demod_get_mode(dem)) {
+  // the stages finish the block they're on, then wait for the new filters
+  _demod_lock_stages(dem);
+
+  switch (common.mode) {
   case DEMOD_FM:
-    _demod_fm_init(dem);
+    if ((rebuilt = dem->fm.input_rate != common.input_rate ||
+	 dem->fm.output_rate != common.output_rate ||
+	 dem->fm.fixed != common.fixed_point ||
+	 dem->fm.filter != common.fm_filter)) {
+      _demod_fm_init(dem, & common);
+    }
+    else if (reset) {
+      _demod_fm_reset(dem);
+    }
     break;
   case DEMOD_AM:
-    _demod_am_init(dem);
+    if ((rebuilt = dem->am.input_rate != common.input_rate ||
+	 dem->am.output_rate != common.output_rate ||
+	 dem->am.fixed != common.fixed_point ||
+	 dem->am.filter != common.am_filter)) {
+      _demod_am_init(dem, & common);
+    }
+    else if (reset) {
+      _demod_am_reset(dem);
+    }
     break;
   default: break;
   }
 
-  if (_demod_get_state(dem) == DEMOD_HALTED) {
-    pthread_create( & dem->thread, NULL, _demod_thread_fn, (void *) dem); }
+  // whatever's still queued was made by the old filters
+  if (rebuilt || reset) { dem->gen++; }
+
+  dem->applied = common;
+
+  _demod_unlock_stages(dem);
+
+  // the channel grid depends on the input rate, and the channels' audio
+  // filters on the output rate too, start over if they changed
+  pthread_mutex_lock( & dem->channels_m);
+
+  if (dem->channels != NULL &&
+      (channelizer_get_input_rate(dem->channels) != common.input_rate ||
+       channelizer_get_output_rate(dem->channels) != common.output_rate)) {
+    channelizer_destroy(dem->channels);
+    dem->channels = channelizer_create(common.input_rate,
+				       demod_lookup_frequency_step(DEMOD_FM),
+				       common.output_rate);
+    dem->listen_k = -1;
+  }
+
+  pthread_mutex_unlock( & dem->channels_m);
+
+  if (_demod_get_state(dem) == DEMOD_HALTED) { _demod_start_stages(dem); }
   
   _demod_set_state(dem, DEMOD_RUNNING);
 }
 
 float demod_get_snr(demod dem)
 {
-  float snr;
-  pthread_mutex_lock( & dem->metrics_m);
-  snr = dem->metrics.snr;
-  pthread_mutex_unlock( & dem->metrics_m);
-  return snr;
+  return spectrum_get_snr(dem->spectrum);
+}
+
+/**
+ * Copies up to len bins of input power (dB, -fs/2 to fs/2) into buf, returns
+ * the number copied (0 until there's an estimate since the last reset).
+ */
+int demod_get_spectrum(demod dem, float * buf, int len)
+{
+  return (int) spectrum_get_power(dem->spectrum, buf, (unsigned int) len,
+				  NULL);
+}
+
+/**
+ * Mean and deviation (dB) of the SNR estimates made from samples captured
+ * under tune_gen, returns how many there are (0 if the samples haven't come
+ * through yet).
+ */
+unsigned int demod_get_snr_stats(demod dem, uint32_t tune_gen, float * mean,
+				 float * deviation)
+{
+  if (atomic_load( & dem->tune_gen) != tune_gen) { return 0; }
+
+  return spectrum_get_snr_stats(dem->spectrum, mean, deviation);
+}
+
+/**
+ * Analyzes every sample of every block, so the spectrum covers the whole
+ * capture (for a wideband scan), instead of the usual cheap narrowband view
+ * used for the SNR. Resets the estimate.
+ */
+void demod_set_wideband_spectrum(demod dem, bool wideband)
+{
+  unsigned int cadence = wideband ? 1 : DEMOD_SPECTRUM_CADENCE;
+
+  // the display keeps its cadence in blocks of input
+  atomic_store( & dem->raw_cadence, cadence);
+  spectrum_set_cadence(dem->display, DEMOD_DISPLAY_CADENCE / cadence);
+  spectrum_set_step(dem->spectrum, wideband ? 1 : DEMOD_SPECTRUM_STEP);
+  spectrum_reset(dem->spectrum);
+}
+
+/**
+ * Starts or stops estimating the whole capture's spectrum for display
+ * (demod_get_display_spectrum), which costs about as much as the SNR
+ * estimate.
+ */
+void demod_set_display_spectrum(demod dem, bool enabled)
+{
+  if (enabled && ! atomic_load( & dem->display_enabled)) {
+    spectrum_reset(dem->display); }
+
+  atomic_store( & dem->display_enabled, enabled);
+}
+
+/**
+ * Copies up to len bins of the whole capture's power (dB, -fs/2 to fs/2)
+ * into buf, returns the number copied (0 if there's no estimate yet). gen
+ * changes with every new estimate, so the same one needn't be used twice.
+ */
+int demod_get_display_spectrum(demod dem, float * buf, int len,
+			       unsigned int * gen)
+{
+  if ( ! atomic_load( & dem->display_enabled)) { return 0; }
+
+  return (int) spectrum_get_power(dem->display, buf, (unsigned int) len, gen);
+}
+
+/**
+ * Display spectrum estimates made a second (0 until a block's come through),
+ * which is as often as there's anything new to show.
+ */
+float demod_get_display_rate(demod dem)
+{
+  unsigned int block_len = atomic_load( & dem->block_len);
+
+  if (block_len == 0) { return 0.0f; }
+
+  return (float) demod_get_input_rate(dem) /
+    (float) (block_len * DEMOD_DISPLAY_CADENCE);
 }
 
 float demod_get_throughput(demod dem)
@@ -571,13 +1857,84 @@ float demod_get_throughput(demod dem)
   return throughput;
 }
 
+/**
+ * Starts or stops measuring the power in every FM channel of the capture
+ * (which listening to one of them needs).
+ */
+void demod_set_channel_monitor(demod dem, bool enabled)
+{
+  pthread_mutex_lock( & dem->channels_m);
+
+  if (enabled && dem->channels == NULL) {
+    dem->channels = channelizer_create(demod_get_input_rate(dem),
+				       demod_lookup_frequency_step(DEMOD_FM),
+				       demod_get_output_rate(dem));
+  }
+  else if ( ! enabled && dem->channels != NULL) {
+    channelizer_destroy(dem->channels);
+    dem->channels = NULL;
+
+    // back to the tuned station
+    atomic_store( & dem->listening, false);
+  }
+
+  dem->listen_k = -1;
+  atomic_store( & dem->channels_enabled, enabled);
+
+  pthread_mutex_unlock( & dem->channels_m);
+}
+
+/**
+ * Has the output carry the monitored channel nearest center_freq instead of
+ * the tuned station, without retuning, for as long as it's in the capture
+ * and the demod's in FM (otherwise, or with 0, it's the tuned station).
+ */
+void demod_set_listen_freq(demod dem, uint32_t center_freq)
+{
+  pthread_mutex_lock( & dem->channels_m);
+  dem->listen_fc = center_freq;
+  pthread_mutex_unlock( & dem->channels_m);
+}
+
+/**
+ * Describes channel k: its center frequency and power over the last block
+ * (dB). Returns false if there's no such channel, or nothing's been measured
+ * since the last retune.
+ */
+bool demod_get_channel(demod dem, int k, uint32_t * center_freq, float * power)
+{
+  bool found = false;
+
+  pthread_mutex_lock( & dem->channels_m);
+
+  if (dem->channels != NULL && channelizer_is_measured(dem->channels) &&
+      k >= 0 && k < channelizer_get_num_channels(dem->channels)) {
+    * center_freq = dem->channels_fc +
+      channelizer_get_offset(dem->channels, k);
+    * power = channelizer_get_power(dem->channels, k);
+    found = true;
+  }
+
+  pthread_mutex_unlock( & dem->channels_m);
+
+  return found;
+}
+
+unsigned int demod_get_overruns(demod dem)
+{
+  return ring_get_overruns(dem->input.r);
+}
+
+unsigned int demod_get_underruns(demod dem)
+{
+  return ring_get_underruns(dem->input.r);
+}
+
 int demod_get_decim_factor(demod dem)
 {
-  int decim_factor;
-  pthread_mutex_lock( & dem->common_m);
-  decim_factor = dem->common.input_rate / dem->common.output_rate;
-  pthread_mutex_unlock( & dem->common_m);
-  return decim_factor;
+  struct demod_common_s common;
+  _demod_get_common(dem, & common);
+  return common.input_rate / common.output_rate;
 }
 
 int demod_get_frequency_step(demod dem)
@@ -587,11 +1944,9 @@ int demod_get_frequency_step(demod dem)
 
 demod_mode demod_get_mode(demod dem)
 {
-  demod_mode mode;
-  pthread_mutex_lock( & dem->common_m);
-  mode = dem->common.mode;
-  pthread_mutex_unlock( & dem->common_m);
-  return mode;
+  struct demod_common_s common;
+  _demod_get_common(dem, & common);
+  return common.mode;
 }
 
 const char * demod_get_mode_name(demod dem)
@@ -601,81 +1956,228 @@ const char * demod_get_mode_name(demod dem)
 
 void demod_set_mode(demod dem, demod_mode mode)
 {
-  pthread_mutex_lock( & dem->common_m);
+  seqlock_write_begin( & dem->common_lock);
   dem->common.mode = mode;
-  pthread_mutex_unlock( & dem->common_m);
+  seqlock_write_end( & dem->common_lock);
 }
 
 uint32_t demod_get_center_freq(demod dem)
 {
-  uint32_t center_freq;
-  pthread_mutex_lock( & dem->common_m);
-  center_freq = dem->common.center_freq;
-  pthread_mutex_unlock( & dem->common_m);
-  return center_freq;
+  struct demod_common_s common;
+  _demod_get_common(dem, & common);
+  return common.center_freq;
+}
+
+/**
+ * Whether a frequency-only change (see demod_execute) clears the filter
+ * state, dropping samples from the old frequency, or keeps it for a
+ * seamless (but briefly mixed) transition. Defaults to true.
+ */
+void demod_set_reset_on_retune(demod dem, bool reset)
+{
+  seqlock_write_begin( & dem->common_lock);
+  dem->common.reset_on_retune = reset;
+  seqlock_write_end( & dem->common_lock);
+}
+
+/**
+ * Switches between the float and integer pipelines (see DEMOD_FIXED_POINT),
+ * takes effect at the next demod_execute.
+ */
+void demod_set_fixed_point(demod dem, bool fixed_point)
+{
+  seqlock_write_begin( & dem->common_lock);
+  dem->common.fixed_point = fixed_point;
+  seqlock_write_end( & dem->common_lock);
 }
 
+/**
+ * Chooses how a mode's float pipeline does its first decimation: a CIC and
+ * half-band front end ahead of msresamp, an overlap-save FFT filter, or
+ * (DEMOD_FILTER_AUTO) whichever is estimated to be cheaper for the rates.
+ * Takes effect at the next demod_execute.
+ */
+void demod_set_filter(demod dem, demod_mode mode, demod_filter filter)
+{
+  seqlock_write_begin( & dem->common_lock);
+
+  switch (mode) {
+  case DEMOD_FM:
+    dem->common.fm_filter = filter;
+    break;
+  case DEMOD_AM:
+    dem->common.am_filter = filter;
+    break;
+  default: break;
+  }
+
+  seqlock_write_end( & dem->common_lock);
+}
+
+/**
+ * Set it before retuning the RTL, so the samples from the new tuning are
+ * taken to be at this frequency.
+ */
 void demod_set_center_freq(demod dem, uint32_t center_freq)
 {
-  pthread_mutex_lock( & dem->common_m);
+  seqlock_write_begin( & dem->common_lock);
   dem->common.center_freq = center_freq;
-  pthread_mutex_unlock( & dem->common_m);
+  seqlock_write_end( & dem->common_lock);
 }
 
 int demod_get_input_rate(demod dem)
 {
-  int input_rate;
-  pthread_mutex_lock( & dem->common_m);
-  input_rate = dem->common.input_rate;
-  pthread_mutex_unlock( & dem->common_m);
-  return input_rate;
+  struct demod_common_s common;
+  _demod_get_common(dem, & common);
+  return common.input_rate;
 }
 
 void demod_set_input_rate(demod dem, int input_rate)
 {
-  pthread_mutex_lock( & dem->common_m);
+  seqlock_write_begin( & dem->common_lock);
   dem->common.input_rate = input_rate;
-  pthread_mutex_unlock( & dem->common_m);
+  seqlock_write_end( & dem->common_lock);
 }
 
 int demod_get_output_rate(demod dem)
 {
-  int output_rate;
-  pthread_mutex_lock( & dem->common_m);
-  output_rate = dem->common.output_rate;
-  pthread_mutex_unlock( & dem->common_m);
-  return output_rate;
+  struct demod_common_s common;
+  _demod_get_common(dem, & common);
+  return common.output_rate;
 }
 
 void demod_set_output_rate(demod dem, int output_rate)
 {
-  pthread_mutex_lock( & dem->common_m);
+  seqlock_write_begin( & dem->common_lock);
   dem->common.output_rate = output_rate;
-  pthread_mutex_unlock( & dem->common_m);
+  seqlock_write_end( & dem->common_lock);
 }
 
-void demod_pop_and_lock(demod dem, int16_t ** buf, int * len)
+/**
+ * Sequence number of the next output block, where a new reader starts.
+ */
+uint32_t demod_get_output_seq(demod dem)
 {
-  safe_cond_wait( & dem->output_ready, & dem->output_ready_m);
-  
-  *buf = dem->output;
-  *len = dem->output_len;
-  
+  uint32_t seq;
   pthread_mutex_lock( & dem->output_m);
+  seq = dem->output_seq;
+  pthread_mutex_unlock( & dem->output_m);
+  return seq;
 }
 
-void demod_push(demod dem, int8_t * buf, int len)
+/**
+ * Waits for output block number *next and takes a reference to it, to be
+ * handed back with demod_release_block. A reader that's fallen more than
+ * DEMOD_OUTPUT_DEPTH blocks behind gets the oldest block still kept instead,
+ * *skipped is the number of blocks it missed. *next is advanced past the
+ * block returned. Returns NULL once the demod is exiting.
+ */
+const struct demod_block_s * demod_acquire_block(demod dem,
+						 uint32_t * next,
+						 unsigned int * skipped)
 {
-  pthread_mutex_lock( & dem->input_m);
-  dem->input_len = len;
-  memcpy(dem->input, buf, len * sizeof(int8_t));
-  pthread_mutex_unlock( & dem->input_m);
+  struct demod_slot_s * slot = NULL;
+  uint32_t oldest;
 
-  // we've acquired new samples
-  safe_cond_signal( & dem->input_ready, & dem->input_ready_m);
+  * skipped = 0;
+
+  pthread_mutex_lock( & dem->output_m);
+
+  while (slot == NULL) {
+    while ((int32_t) (dem->output_seq - * next) <= 0 &&
+	   _demod_get_state(dem) != DEMOD_EXITING) {
+      pthread_cond_wait( & dem->output_ready, & dem->output_m);
+    }
+
+    if (_demod_get_state(dem) == DEMOD_EXITING) { break; }
+
+    oldest = dem->output_seq - DEMOD_OUTPUT_DEPTH;
+
+    if ((int32_t) (oldest - * next) > 0) {
+      * skipped += oldest - * next;
+      * next = oldest;
+    }
+
+    slot = dem->output_index[* next % DEMOD_OUTPUT_DEPTH];
+
+    // lost, or being overwritten
+    if (slot == NULL || slot->block.seq != * next) {
+      slot = NULL;
+      (* skipped)++;
+      (* next)++;
+    }
+  }
+
+  if (slot != NULL) {
+    slot->refs++;
+    * next = slot->block.seq + 1;
+  }
+
+  pthread_mutex_unlock( & dem->output_m);
+
+  return slot != NULL ? & slot->block : NULL;
 }
 
-void demod_release(demod dem)
+void demod_release_block(demod dem, const struct demod_block_s * block)
 {
+  pthread_mutex_lock( & dem->output_m);
+  ((struct demod_slot_s *) block)->refs--;
   pthread_mutex_unlock( & dem->output_m);
 }
+
+/**
+ * Blocking input is for sources that can run faster than real time (e.g. a
+ * free-running replay); a live dongle can't be stalled, so it's off by
+ * default. Set it before demod_execute.
+ */
+void demod_set_input_blocking(demod dem, bool blocking)
+{
+  dem->input_blocking = blocking;
+}
+
+/**
+ * Pins a pipeline stage's thread to a CPU (-1, the default, leaves it to the
+ * scheduler). Set it before demod_execute.
+ */
+void demod_set_stage_cpu(demod dem, demod_stage stage, int cpu)
+{
+  dem->cpus[stage] = cpu;
+}
+
+/**
+ * Leaves room before and after every output block's data, so a reader can
+ * frame it in place (e.g. for a websocket) instead of copying it out. The
+ * headroom is rounded up to keep the data aligned. Set it before
+ * demod_execute.
+ */
+void demod_set_output_padding(demod dem, size_t headroom, size_t tailroom)
+{
+  if (_demod_get_state(dem) != DEMOD_HALTED) { return; }
+
+  dem->output_headroom = (headroom + CACHE_LINE_SIZE - 1) &
+    ~((size_t) CACHE_LINE_SIZE - 1);
+  dem->output_tailroom = tailroom;
+
+  _demod_alloc_output(dem);
+}
+
+void demod_push(demod dem, uint8_t * buf, int len, uint32_t tune_gen)
+{
+  if (dem->input_blocking) {
+    pthread_mutex_lock( & dem->input.space_m);
+
+    while (ring_is_full(dem->input.r) &&
+	   _demod_get_state(dem) != DEMOD_EXITING) {
+      pthread_cond_wait( & dem->input.space, & dem->input.space_m);
+    }
+
+    pthread_mutex_unlock( & dem->input.space_m);
+  }
+
+  // if the demod has fallen behind the block is dropped (and counted)
+  if ( ! ring_push(dem->input.r, buf, len * sizeof(uint8_t), tune_gen)) {
+    return; }
+
+  // we've acquired new samples
+  safe_cond_signal( & dem->input.ready, & dem->input.ready_m);
+}
@@ -0,0 +1,276 @@
+#include <complex.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "detect.h"
+
+// Abramowitz & Stegun 4.4.49, atan(t) for 0 <= t <= 1, |error| <= 1e-5 (a
+// little more once float rounding is counted, still under 2e-5)
+#define DETECT_A1 0.9998660f
+#define DETECT_A3 -0.3302995f
+#define DETECT_A5 0.1801410f
+#define DETECT_A7 -0.0851330f
+#define DETECT_A9 0.0208351f
+
+#define DETECT_PI 3.14159265f
+#define DETECT_PI_2 1.57079633f
+
+// keeps 0/0 out of the ratio below
+#define DETECT_TINY 1e-30f
+
+// CORDIC iterations, and the gain they leave on the magnitude (Q15 inverse)
+#define DETECT_CORDIC_STEPS 15
+#define DETECT_CORDIC_INV_GAIN 19898
+
+#define DETECT_S16_MAX 32767
+#define DETECT_S16_MIN -32768
+
+// atan(2^-i) with 32768 standing for pi
+static const int32_t _detect_cordic_atan[DETECT_CORDIC_STEPS] = {
+  8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1, 1
+};
+
+// GCC vector extensions, lowered to SSE2 or NEON (or plain code) as available
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+
+static inline v4sf _detect_load(const float * p)
+{
+  v4sf v;
+  memcpy( & v, p, sizeof(v));
+  return v;
+}
+
+static inline void _detect_store(float * p, v4sf v)
+{
+  memcpy(p, & v, sizeof(v));
+}
+
+static inline v4sf _detect_select(v4si mask, v4sf a, v4sf b)
+{
+  return (v4sf) (((v4si) a & mask) | ((v4si) b & ~mask));
+}
+
+float detect_atan2(float y, float x)
+{
+  float ax = fabsf(x), ay = fabsf(y);
+  float t, t2, p;
+
+  t = ay > ax ? ax / (ay + DETECT_TINY) : ay / (ax + DETECT_TINY);
+  t2 = t*t;
+
+  p = t*(DETECT_A1 + t2*(DETECT_A3 + t2*(DETECT_A5 + t2*(DETECT_A7 +
+							 t2*DETECT_A9))));
+
+  if (ay > ax) { p = DETECT_PI_2 - p; }
+  if (x < 0.0f) { p = DETECT_PI - p; }
+
+  return copysignf(p, y);
+}
+
+static inline v4sf _detect_atan2_v4(v4sf y, v4sf x)
+{
+  const v4si abs_mask = { 0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff };
+  const v4si sign_mask = ~abs_mask;
+  const v4sf zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  v4sf ax = (v4sf) ((v4si) x & abs_mask);
+  v4sf ay = (v4sf) ((v4si) y & abs_mask);
+
+  v4si swap = ay > ax;
+
+  v4sf t = _detect_select(swap, ax, ay) /
+    (_detect_select(swap, ay, ax) + DETECT_TINY);
+  v4sf t2 = t*t;
+
+  v4sf p = t*(DETECT_A1 + t2*(DETECT_A3 + t2*(DETECT_A5 + t2*(DETECT_A7 +
+							      t2*DETECT_A9))));
+
+  p = _detect_select(swap, DETECT_PI_2 - p, p);
+  p = _detect_select(x < zero, DETECT_PI - p, p);
+
+  // take the sign of y
+  return (v4sf) ((v4si) p | ((v4si) y & sign_mask));
+}
+
+void detect_fm(const float complex * x,
+	       unsigned int n,
+	       float complex * prev,
+	       float gain,
+	       float * y)
+{
+  const v4si even = { 0, 2, 4, 6 };
+  const v4si odd = { 1, 3, 5, 7 };
+
+  const float * xf = (const float *) x;
+
+  float complex d;
+  unsigned int i;
+
+  if (n == 0) { return; }
+
+  // first sample pairs with the end of the previous block
+  d = x[0] * conjf( * prev);
+  y[0] = gain * detect_atan2(cimagf(d), crealf(d));
+
+  for (i = 1; i + 4 <= n; i += 4) {
+    v4sf a = _detect_load(xf + 2*i);
+    v4sf b = _detect_load(xf + 2*i + 4);
+    v4sf c = _detect_load(xf + 2*i - 2);
+    v4sf e = _detect_load(xf + 2*i + 2);
+
+    // deinterleave
+    v4sf xr = __builtin_shuffle(a, b, even);
+    v4sf xi = __builtin_shuffle(a, b, odd);
+    v4sf pr = __builtin_shuffle(c, e, even);
+    v4sf pi = __builtin_shuffle(c, e, odd);
+
+    // x * conj(p)
+    v4sf dr = xr*pr + xi*pi;
+    v4sf di = xi*pr - xr*pi;
+
+    _detect_store(y + i, gain * _detect_atan2_v4(di, dr));
+  }
+
+  for (; i < n; i++) {
+    d = x[i] * conjf(x[i-1]);
+    y[i] = gain * detect_atan2(cimagf(d), crealf(d));
+  }
+
+  * prev = x[n-1];
+}
+
+void detect_am(const float complex * x,
+	       unsigned int n,
+	       float * carrier,
+	       float alpha,
+	       float * y)
+{
+  float c = * carrier;
+  float e, sum = 0.0f;
+  unsigned int i;
+
+  if (n == 0) { return; }
+
+  // start from the first block's mean level, not a carrier of nothing
+  if (c <= 0.0f) {
+    for (i = 0; i < n; i++) {
+      sum += sqrtf(crealf(x[i])*crealf(x[i]) + cimagf(x[i])*cimagf(x[i])); }
+
+    c = sum / n;
+  }
+
+  for (i = 0; i < n; i++) {
+    e = sqrtf(crealf(x[i])*crealf(x[i]) + cimagf(x[i])*cimagf(x[i]));
+
+    c += alpha * (e - c);
+
+    y[i] = (e - c) / (c + DETECT_TINY);
+  }
+
+  * carrier = c;
+}
+
+int16_t detect_atan2_q15(int32_t y, int32_t x, int32_t * mag)
+{
+  uint16_t angle = 0;
+  int32_t t;
+  int i;
+
+  // headroom for the shifts below, inputs are at most 16 bits
+  x <<= 8;
+  y <<= 8;
+
+  // rotate by pi into the right half plane
+  if (x < 0) {
+    angle = 32768;
+    x = -x;
+    y = -y;
+  }
+
+  for (i = 0; i < DETECT_CORDIC_STEPS; i++) {
+    if (y > 0) {
+      t = x + (y >> i);
+      y = y - (x >> i);
+      angle += _detect_cordic_atan[i];
+    }
+    else {
+      t = x - (y >> i);
+      y = y + (x >> i);
+      angle -= _detect_cordic_atan[i];
+    }
+
+    x = t;
+  }
+
+  if (mag != NULL) {
+    * mag = (int32_t) (((int64_t) x * DETECT_CORDIC_INV_GAIN) >> (15 + 8)); }
+
+  return (int16_t) angle;
+}
+
+void detect_fm_q15(const int16_t * x,
+		   unsigned int n,
+		   int16_t * phase,
+		   int16_t * y)
+{
+  uint16_t prev = (uint16_t) * phase;
+  uint16_t a;
+  unsigned int i;
+
+  // the phase difference wraps around by itself in 16 bits
+  for (i = 0; i < n; i++) {
+    a = (uint16_t) detect_atan2_q15(x[2*i+1], x[2*i], NULL);
+    y[i] = (int16_t) (uint16_t) (a - prev) / 2;
+    prev = a;
+  }
+
+  * phase = (int16_t) prev;
+}
+
+void detect_am_q15(const int16_t * x,
+		   unsigned int n,
+		   int32_t * carrier,
+		   unsigned int alpha_shift,
+		   int16_t gain,
+		   int16_t * y)
+{
+  int32_t c = * carrier;
+  int32_t e;
+  int64_t r, t, sum = 0;
+  unsigned int i;
+
+  if (n == 0) { return; }
+
+  // start from the first block's mean level, not a carrier of nothing
+  if (c <= 0) {
+    for (i = 0; i < n; i++) {
+      detect_atan2_q15(x[2*i+1], x[2*i], & e);
+      sum += e;
+    }
+
+    c = (int32_t) ((sum << 8) / n);
+  }
+
+  // the carrier moves slowly next to a block, so it's normalized by the
+  // level the block starts at, a Q24 reciprocal instead of a divide per
+  // sample (below one unit there's no carrier to speak of)
+  r = c >= 256 ? ((int64_t) gain << 24) / c : 0;
+
+  for (i = 0; i < n; i++) {
+    detect_atan2_q15(x[2*i+1], x[2*i], & e);
+
+    e <<= 8;
+    c += (e - c) >> alpha_shift;
+
+    t = (((int64_t) (e - c)) * r) >> 24;
+
+    if (t > DETECT_S16_MAX) { t = DETECT_S16_MAX; }
+    else if (t < DETECT_S16_MIN) { t = DETECT_S16_MIN; }
+
+    y[i] = (int16_t) t;
+  }
+
+  * carrier = c;
+}
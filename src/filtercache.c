@@ -0,0 +1,228 @@
+#include <liquid/liquid.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "filtercache.h"
+
+typedef enum { FILTERCACHE_EMPTY, FILTERCACHE_MSRESAMP, FILTERCACHE_RESAMP }
+  filtercache_kind;
+
+struct filtercache_entry_s
+{
+  filtercache_kind kind;
+
+  // design parameters (h_len, fc and npfb only apply to resamp)
+  float r;
+  float As;
+  unsigned int h_len;
+  float fc;
+  unsigned int npfb;
+
+  void * q;
+  bool in_use;
+
+  // for evicting the least recently used idle entry
+  unsigned long last_used;
+};
+
+static struct filtercache_entry_s _filtercache_entries[FILTERCACHE_SIZE];
+static unsigned long _filtercache_ticks = 0;
+static pthread_mutex_t _filtercache_entries_m = PTHREAD_MUTEX_INITIALIZER;
+
+static void _filtercache_destroy(filtercache_kind kind, void * q)
+{
+  switch (kind) {
+  case FILTERCACHE_MSRESAMP:
+    msresamp_crcf_destroy((msresamp_crcf) q);
+    break;
+  case FILTERCACHE_RESAMP:
+    resamp_rrrf_destroy((resamp_rrrf) q);
+    break;
+  default: break;
+  }
+}
+
+/**
+ * Looks for an idle object designed with the given parameters. The lock must
+ * be held.
+ */
+static struct filtercache_entry_s * _filtercache_find(struct filtercache_entry_s * key)
+{
+  int i;
+
+  for (i = 0; i < FILTERCACHE_SIZE; i++) {
+    struct filtercache_entry_s * e = & _filtercache_entries[i];
+
+    if (e->kind == key->kind && ! e->in_use && e->r == key->r &&
+	e->As == key->As && e->h_len == key->h_len && e->fc == key->fc &&
+	e->npfb == key->npfb) {
+      return e;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Records a newly designed object, evicting the least recently used idle one
+ * if the cache is full. If everything is in use the object isn't tracked and
+ * will simply be destroyed when it's put back. The lock must be held.
+ */
+static void _filtercache_insert(struct filtercache_entry_s * key, void * q)
+{
+  struct filtercache_entry_s * victim = NULL;
+  int i;
+
+  for (i = 0; i < FILTERCACHE_SIZE; i++) {
+    struct filtercache_entry_s * e = & _filtercache_entries[i];
+
+    if (e->kind == FILTERCACHE_EMPTY) { victim = e; break; }
+
+    if ( ! e->in_use && (victim == NULL || e->last_used < victim->last_used)) {
+      victim = e; }
+  }
+
+  if (victim == NULL) { return; }
+
+  _filtercache_destroy(victim->kind, victim->q);
+
+  * victim = * key;
+  victim->q = q;
+  victim->in_use = true;
+  victim->last_used = _filtercache_ticks++;
+}
+
+static void * _filtercache_get(struct filtercache_entry_s * key)
+{
+  struct filtercache_entry_s * e;
+  void * q;
+
+  pthread_mutex_lock( & _filtercache_entries_m);
+
+  if ((e = _filtercache_find(key)) != NULL) {
+    e->in_use = true;
+    e->last_used = _filtercache_ticks++;
+    q = e->q;
+
+    pthread_mutex_unlock( & _filtercache_entries_m);
+
+    return q;
+  }
+
+  pthread_mutex_unlock( & _filtercache_entries_m);
+
+  // design outside the lock, it's the slow part
+  switch (key->kind) {
+  case FILTERCACHE_MSRESAMP:
+    q = msresamp_crcf_create(key->r, key->As);
+    break;
+  case FILTERCACHE_RESAMP:
+    q = resamp_rrrf_create(key->r, key->h_len, key->fc, key->As, key->npfb);
+    break;
+  default:
+    return NULL;
+  }
+
+  pthread_mutex_lock( & _filtercache_entries_m);
+  _filtercache_insert(key, q);
+  pthread_mutex_unlock( & _filtercache_entries_m);
+
+  return q;
+}
+
+static void _filtercache_put(filtercache_kind kind, void * q)
+{
+  int i;
+
+  pthread_mutex_lock( & _filtercache_entries_m);
+
+  for (i = 0; i < FILTERCACHE_SIZE; i++) {
+    struct filtercache_entry_s * e = & _filtercache_entries[i];
+
+    if (e->kind == kind && e->q == q) {
+      e->in_use = false;
+
+      pthread_mutex_unlock( & _filtercache_entries_m);
+
+      return;
+    }
+  }
+
+  pthread_mutex_unlock( & _filtercache_entries_m);
+
+  // wasn't tracked
+  _filtercache_destroy(kind, q);
+}
+
+msresamp_crcf filtercache_get_msresamp(float r, float As)
+{
+  struct filtercache_entry_s key;
+  msresamp_crcf q;
+
+  memset( & key, 0, sizeof(key));
+  key.kind = FILTERCACHE_MSRESAMP;
+  key.r = r;
+  key.As = As;
+
+  q = (msresamp_crcf) _filtercache_get( & key);
+  msresamp_crcf_reset(q);
+
+  return q;
+}
+
+void filtercache_put_msresamp(msresamp_crcf q)
+{
+  _filtercache_put(FILTERCACHE_MSRESAMP, (void *) q);
+}
+
+resamp_rrrf filtercache_get_resamp(float r,
+				   unsigned int h_len,
+				   float fc,
+				   float As,
+				   unsigned int npfb)
+{
+  struct filtercache_entry_s key;
+  resamp_rrrf q;
+
+  memset( & key, 0, sizeof(key));
+  key.kind = FILTERCACHE_RESAMP;
+  key.r = r;
+  key.As = As;
+  key.h_len = h_len;
+  key.fc = fc;
+  key.npfb = npfb;
+
+  q = (resamp_rrrf) _filtercache_get( & key);
+  resamp_rrrf_reset(q);
+
+  return q;
+}
+
+void filtercache_put_resamp(resamp_rrrf q)
+{
+  _filtercache_put(FILTERCACHE_RESAMP, (void *) q);
+}
+
+/**
+ * Destroys every idle object. Anything still in use is left alone.
+ */
+void filtercache_clear()
+{
+  int i;
+
+  pthread_mutex_lock( & _filtercache_entries_m);
+
+  for (i = 0; i < FILTERCACHE_SIZE; i++) {
+    struct filtercache_entry_s * e = & _filtercache_entries[i];
+
+    if (e->kind != FILTERCACHE_EMPTY && ! e->in_use) {
+      _filtercache_destroy(e->kind, e->q);
+      memset(e, 0, sizeof(*e));
+    }
+  }
+
+  pthread_mutex_unlock( & _filtercache_entries_m);
+}
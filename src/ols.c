@@ -0,0 +1,172 @@
+#include <complex.h>
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convert.h"
+#include "macros.h"
+#include "ols.h"
+
+struct ols_s
+{
+  unsigned int D;
+
+  // filter length, overlap (L-1 rounded up to a multiple of D), FFT size
+  // (D*M) and the number of new input samples per FFT (N-V)
+  unsigned int L;
+  unsigned int V;
+  unsigned int N;
+  unsigned int M;
+  unsigned int S;
+
+  // input block: V samples carried over, then new ones up to N
+  float complex * buf;
+  unsigned int fill;
+
+  float complex * X;
+  float complex * H; // filter response, scaled by 1/N
+  float complex * Z; // folded spectrum
+  float complex * z;
+
+  fftplan forward;
+  fftplan backward;
+};
+
+/**
+ * Picks the block sizes for a filter: the FFT is at least four times the
+ * overlap so most of each block is new samples.
+ */
+static void _ols_size(unsigned int D, float df, float As,
+		      unsigned int * L, unsigned int * V, unsigned int * M)
+{
+  * L = (unsigned int) ceilf((As - 7.95f) / (14.36f * df)) + 1;
+  * V = ((* L - 1 + D - 1) / D) * D;
+
+  for (* M = 2; D * (* M) < 4 * (* V); * M *= 2);
+}
+
+float ols_estimate_cost(unsigned int D, float df, float As)
+{
+  unsigned int L, V, M, N;
+
+  _ols_size(D, df, As, & L, & V, & M);
+  N = D * M;
+
+  // 5 N log2 N per FFT, complex multiply and fold, then conversion
+  return (5.0f * N * log2f(N) + 8.0f * N + 5.0f * M * log2f(M)) /
+    (float) (N - V) + 2.0f;
+}
+
+ols ols_create(unsigned int D, float fc, float df, float As)
+{
+  ols q = (ols) malloc(sizeof(struct ols_s));
+
+  unsigned int i;
+  float * h, sum = 0.0f;
+
+  q->D = D;
+
+  _ols_size(D, df, As, & q->L, & q->V, & q->M);
+  q->N = D * q->M;
+  q->S = q->N - q->V;
+
+  q->buf = (float complex *) malloc(q->N * sizeof(float complex));
+  q->X = (float complex *) malloc(q->N * sizeof(float complex));
+  q->H = (float complex *) malloc(q->N * sizeof(float complex));
+  q->Z = (float complex *) malloc(q->M * sizeof(float complex));
+  q->z = (float complex *) malloc(q->M * sizeof(float complex));
+
+  q->forward = fft_create_plan(q->N, q->buf, q->X, LIQUID_FFT_FORWARD, 0);
+  q->backward = fft_create_plan(q->M, q->Z, q->z, LIQUID_FFT_BACKWARD, 0);
+
+  // unity gain low-pass, transformed with the same plan as the input
+  h = (float *) malloc(q->L * sizeof(float));
+  liquid_firdes_kaiser(q->L, fc, As, 0.0f, h);
+
+  for (i = 0; i < q->L; i++) { sum += h[i]; }
+
+  memset(q->buf, 0, q->N * sizeof(float complex));
+  for (i = 0; i < q->L; i++) { q->buf[i] = h[i] / sum; }
+
+  fft_execute(q->forward);
+
+  for (i = 0; i < q->N; i++) { q->H[i] = q->X[i] / (float) q->N; }
+
+  free(h);
+
+  ols_reset(q);
+
+  return q;
+}
+
+void ols_destroy(ols q)
+{
+  fft_destroy_plan(q->forward);
+  fft_destroy_plan(q->backward);
+
+  free(q->buf);
+  free(q->X);
+  free(q->H);
+  free(q->Z);
+  free(q->z);
+  free(q);
+}
+
+void ols_reset(ols q)
+{
+  memset(q->buf, 0, q->V * sizeof(float complex));
+  q->fill = q->V;
+}
+
+unsigned int ols_get_decim_factor(ols q)
+{
+  return q->D;
+}
+
+unsigned int ols_get_max_output(ols q, unsigned int n)
+{
+  return (n / q->S + 1) * (q->S / q->D);
+}
+
+void ols_execute_cu8(ols q,
+		     const uint8_t * x,
+		     unsigned int n,
+		     float complex * y,
+		     unsigned int * ny)
+{
+  unsigned int m, i, d, k = 0;
+
+  while (n > 0) {
+    m = q->N - q->fill < n ? q->N - q->fill : n;
+
+    convert_u8_to_cf(x, q->buf + q->fill, m);
+
+    q->fill += m;
+    x += 2*m;
+    n -= m;
+
+    if (q->fill < q->N) { break; }
+
+    fft_execute(q->forward);
+
+    // filter, and fold the D copies of the decimated band onto each other
+    for (i = 0; i < q->M; i++) { q->Z[i] = q->X[i] * q->H[i]; }
+
+    for (d = 1; d < q->D; d++) {
+      for (i = 0; i < q->M; i++) {
+	q->Z[i] += q->X[d * q->M + i] * q->H[d * q->M + i]; }
+    }
+
+    fft_execute(q->backward);
+
+    // the first V/D outputs are wrapped around, the rest are valid
+    for (i = q->V / q->D; i < q->M; i++) { y[k++] = q->z[i]; }
+
+    memmove(q->buf, q->buf + q->S, q->V * sizeof(float complex));
+    q->fill = q->V;
+  }
+
+  * ny = k;
+}
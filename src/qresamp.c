@@ -0,0 +1,219 @@
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "qresamp.h"
+
+#define QRESAMP_S16_MAX 32767
+#define QRESAMP_S16_MIN -32768
+
+struct qresamp_s
+{
+  unsigned int nc; // values per sample, 2 for IQ
+  unsigned int shift;
+
+  // P taps per phase, phase p at h[p*P], stored oldest sample first
+  unsigned int P;
+  unsigned int npfb;
+  unsigned int log2_npfb;
+  int16_t * h;
+
+  // the last P-1 samples followed by the block being resampled
+  int16_t * buf;
+  unsigned int max_input;
+
+  // position of the next output: newest input sample it uses (in buf) plus a
+  // fraction of a sample (Q32), advanced by 1/r for each output
+  unsigned int pos;
+  uint32_t frac;
+  unsigned int step_int;
+  uint32_t step_frac;
+};
+
+qresamp qresamp_create(float r,
+		       float bw,
+		       float As,
+		       unsigned int npfb,
+		       unsigned int shift,
+		       bool cplx,
+		       unsigned int max_input)
+{
+  qresamp q = (qresamp) malloc(sizeof(struct qresamp_s));
+
+  unsigned int i, j, p, n;
+  float fp, fs, fc, sum = 0.0f;
+  double step;
+  float * h;
+
+  if (r > 1.0f || (npfb & (npfb - 1)) != 0) {
+    ERROR("qresamp only decimates, with a power of two number of phases.\n");
+    exit(1);
+  }
+
+  q->nc = cplx ? 2 : 1;
+  q->shift = shift;
+  q->npfb = npfb;
+  q->max_input = max_input;
+
+  for (q->log2_npfb = 0; (1u << q->log2_npfb) < npfb; q->log2_npfb++);
+
+  // passband edge bw*r/2 (relative to the input rate); aliases are only
+  // allowed to land in the transition band, which keeps the filter short
+  fp = bw * r / 2.0f;
+  fs = r - fp < 0.5f ? r - fp : 0.5f;
+  fc = (fp + fs) / 2.0f;
+
+  q->P = (unsigned int) ceilf((As - 7.95f) / (14.36f * (fs - fp))) + 1;
+
+  // prototype at npfb times the input rate
+  n = q->P * npfb;
+  h = (float *) malloc(n * sizeof(float));
+  liquid_firdes_kaiser(n, fc / npfb, As, 0.0f, h);
+
+  // unity gain for every phase
+  for (i = 0; i < n; i++) { sum += h[i]; }
+
+  q->h = (int16_t *) malloc(n * sizeof(int16_t));
+
+  for (p = 0; p < npfb; p++) {
+    for (j = 0; j < q->P; j++) {
+      q->h[p * q->P + (q->P - 1 - j)] =
+	(int16_t) lroundf(h[j * npfb + p] * npfb / sum * 32767.0f);
+    }
+  }
+
+  free(h);
+
+  q->buf = (int16_t *) calloc((q->P - 1 + max_input) * q->nc, sizeof(int16_t));
+
+  step = 1.0 / (double) r;
+  q->step_int = (unsigned int) step;
+  q->step_frac = (uint32_t) ((step - q->step_int) * 4294967296.0);
+
+  qresamp_reset(q);
+
+  return q;
+}
+
+void qresamp_destroy(qresamp q)
+{
+  free(q->h);
+  free(q->buf);
+  free(q);
+}
+
+void qresamp_reset(qresamp q)
+{
+  memset(q->buf, 0, (q->P - 1) * q->nc * sizeof(int16_t));
+
+  q->pos = q->P - 1;
+  q->frac = 0;
+}
+
+static inline int16_t _qresamp_round(int32_t acc, unsigned int shift)
+{
+  acc = (acc + (1 << (shift - 1))) >> shift;
+
+  if (acc > QRESAMP_S16_MAX) { return QRESAMP_S16_MAX; }
+  if (acc < QRESAMP_S16_MIN) { return QRESAMP_S16_MIN; }
+
+  return (int16_t) acc;
+}
+
+/**
+ * Filters the n samples that have just been placed after the history, then
+ * keeps the last P-1 as history for next time.
+ */
+static void _qresamp_run(qresamp q, unsigned int n, int16_t * y, unsigned int * ny)
+{
+  unsigned int end = q->P - 1 + n;
+  unsigned int k = 0, i;
+  uint32_t frac;
+
+  while (q->pos < end) {
+    const int16_t * h = q->h + (q->frac >> (32 - q->log2_npfb)) * q->P;
+    const int16_t * x = q->buf + (q->pos + 1 - q->P) * q->nc;
+
+    if (q->nc == 2) {
+      int32_t ai = 0, aq = 0;
+
+      for (i = 0; i < q->P; i++) {
+	ai += (int32_t) h[i] * x[2*i];
+	aq += (int32_t) h[i] * x[2*i+1];
+      }
+
+      y[2*k] = _qresamp_round(ai, q->shift);
+      y[2*k+1] = _qresamp_round(aq, q->shift);
+    }
+    else {
+      int32_t a = 0;
+
+      for (i = 0; i < q->P; i++) { a += (int32_t) h[i] * x[i]; }
+
+      y[k] = _qresamp_round(a, q->shift);
+    }
+
+    k++;
+
+    frac = q->frac + q->step_frac;
+    q->pos += q->step_int + (frac < q->frac);
+    q->frac = frac;
+  }
+
+  memmove(q->buf, q->buf + n * q->nc, (q->P - 1) * q->nc * sizeof(int16_t));
+  q->pos -= n;
+
+  * ny = k;
+}
+
+void qresamp_execute_cu8(qresamp q,
+			 const uint8_t * x,
+			 unsigned int n,
+			 int16_t * y,
+			 unsigned int * ny)
+{
+  int16_t * b = q->buf + (q->P - 1) * 2;
+  unsigned int m, i, k;
+
+  * ny = 0;
+
+  while (n > 0) {
+    m = n < q->max_input ? n : q->max_input;
+
+    for (i = 0; i < 2*m; i++) { b[i] = (int16_t) x[i] - 128; }
+
+    _qresamp_run(q, m, y + 2 * (* ny), & k);
+
+    * ny += k;
+    x += 2*m;
+    n -= m;
+  }
+}
+
+void qresamp_execute_s16(qresamp q,
+			 const int16_t * x,
+			 unsigned int n,
+			 int16_t * y,
+			 unsigned int * ny)
+{
+  int16_t * b = q->buf + (q->P - 1) * q->nc;
+  unsigned int m, k;
+
+  * ny = 0;
+
+  while (n > 0) {
+    m = n < q->max_input ? n : q->max_input;
+
+    memcpy(b, x, m * q->nc * sizeof(int16_t));
+
+    _qresamp_run(q, m, y + q->nc * (* ny), & k);
+
+    * ny += k;
+    x += m * q->nc;
+    n -= m;
+  }
+}
@@ -0,0 +1,329 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "macros.h"
+#include "replay.h"
+#include "rtl.h"
+
+// same as librtlsdr when read_async is given a zero buffer length
+#define REPLAY_DEFAULT_BUFFER_LENGTH (16 * 32 * 512)
+
+#define REPLAY_SIGMF_DATA ".sigmf-data"
+#define REPLAY_SIGMF_META ".sigmf-meta"
+
+struct replay_common_s
+{
+  uint32_t center_freq;
+  uint32_t sample_rate;
+  bool cancelled;
+};
+
+struct replay_s
+{
+  // the recording, mapped read-only
+  int fd;
+  unsigned char * data;
+  size_t size;
+
+  // deliver at the nominal sample rate (true) or as fast as accepted (false)
+  bool paced;
+
+  // the recording told us its sample rate, so requests to change it are moot
+  bool sample_rate_fixed;
+
+  struct replay_common_s common;
+  pthread_mutex_t common_m;
+};
+
+static bool _replay_has_suffix(const char * s, const char * suffix)
+{
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/**
+ * Finds "key" in a JSON document and returns a pointer just past the colon
+ * that follows it. Good enough for flat SigMF metadata, not a JSON parser.
+ */
+static const char * _replay_find_value(const char * json, const char * key)
+{
+  char quoted[64];
+  const char * s;
+
+  snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+
+  s = strstr(json, quoted);
+  if (s == NULL) { return NULL; }
+
+  s = strchr(s + strlen(quoted), ':');
+  if (s == NULL) { return NULL; }
+
+  // skip whitespace
+  for (s++; *s == ' ' || *s == '\t' || *s == '\n' || *s == '\r'; s++);
+
+  return s;
+}
+
+/**
+ * Reads sample rate and center frequency out of a SigMF metadata file.
+ * Returns -1 if the recording isn't something we can play.
+ */
+static int _replay_read_sigmf_meta(replay rp, const char * path)
+{
+  FILE * f = fopen(path, "r");
+  char json[16384];
+  size_t n;
+  const char * s;
+
+  if (f == NULL) {
+    ERROR("Failed to open %s.\n", path);
+    return -1;
+  }
+
+  n = fread(json, 1, sizeof(json) - 1, f);
+  json[n] = '\0';
+  fclose(f);
+
+  s = _replay_find_value(json, "core:datatype");
+
+  if (s == NULL || strncmp(s, "\"cu8", 4) != 0) {
+    ERROR("Only 8-bit unsigned IQ (cu8) recordings are supported.\n");
+    return -1;
+  }
+
+  s = _replay_find_value(json, "core:sample_rate");
+
+  if (s != NULL) {
+    rp->common.sample_rate = (uint32_t) strtod(s, NULL);
+    rp->sample_rate_fixed = rp->common.sample_rate > 0;
+  }
+
+  s = _replay_find_value(json, "core:frequency");
+  if (s != NULL) { rp->common.center_freq = (uint32_t) strtod(s, NULL); }
+
+  return 0;
+}
+
+replay replay_open(const char * path, bool paced)
+{
+  replay rp = (replay) malloc(sizeof(struct replay_s));
+
+  char data_path[1024];
+  char meta_path[1024];
+  struct stat st;
+
+  rp->paced = paced;
+  rp->sample_rate_fixed = false;
+  rp->common.center_freq = 0;
+  rp->common.sample_rate = RTL_DEFAULT_SAMPLE_RATE;
+  rp->common.cancelled = false;
+
+  snprintf(data_path, sizeof(data_path), "%s", path);
+  meta_path[0] = '\0';
+
+  // SigMF recordings come as a data/meta pair, accept either name
+  if (_replay_has_suffix(path, REPLAY_SIGMF_META)) {
+    snprintf(meta_path, sizeof(meta_path), "%s", path);
+    data_path[strlen(path) - strlen(REPLAY_SIGMF_META)] = '\0';
+    strncat(data_path, REPLAY_SIGMF_DATA,
+	    sizeof(data_path) - strlen(data_path) - 1);
+  }
+  else if (_replay_has_suffix(path, REPLAY_SIGMF_DATA)) {
+    snprintf(meta_path, sizeof(meta_path), "%s", path);
+    meta_path[strlen(path) - strlen(REPLAY_SIGMF_DATA)] = '\0';
+    strncat(meta_path, REPLAY_SIGMF_META,
+	    sizeof(meta_path) - strlen(meta_path) - 1);
+  }
+
+  if (meta_path[0] != '\0' && _replay_read_sigmf_meta(rp, meta_path) < 0) {
+    exit(1);
+  }
+
+  rp->fd = open(data_path, O_RDONLY);
+
+  if (rp->fd < 0 || fstat(rp->fd, & st) < 0 || st.st_size < 2) {
+    ERROR("Failed to open recording %s.\n", data_path);
+    exit(1);
+  }
+
+  // whole IQ pairs only
+  rp->size = (size_t) st.st_size & ~((size_t) 1);
+  rp->data = mmap(NULL, rp->size, PROT_READ, MAP_PRIVATE, rp->fd, 0);
+
+  if (rp->data == MAP_FAILED) {
+    ERROR("Failed to map recording %s.\n", data_path);
+    exit(1);
+  }
+
+  madvise(rp->data, rp->size, MADV_SEQUENTIAL);
+
+  pthread_mutex_init( & rp->common_m, NULL);
+
+  DEBUG("Replaying %s (%zu samples, %s).\n", data_path, rp->size / 2,
+	paced ? "paced" : "free-running");
+
+  return rp;
+}
+
+void replay_close(replay rp)
+{
+  munmap(rp->data, rp->size);
+  close(rp->fd);
+
+  pthread_mutex_destroy( & rp->common_m);
+
+  free(rp);
+}
+
+static bool _replay_is_cancelled(replay rp)
+{
+  bool cancelled;
+  pthread_mutex_lock( & rp->common_m);
+  cancelled = rp->common.cancelled;
+  pthread_mutex_unlock( & rp->common_m);
+  return cancelled;
+}
+
+static void _replay_timespec_add(struct timespec * t, double secs)
+{
+  long nsec = (long) (secs * 1e9);
+
+  t->tv_sec += nsec / 1000000000L;
+  t->tv_nsec += nsec % 1000000000L;
+
+  if (t->tv_nsec >= 1000000000L) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000000000L;
+  }
+}
+
+static double _replay_timespec_diff(struct timespec * a, struct timespec * b)
+{
+  return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+/**
+ * Mirrors rtlsdr_read_async: takes over the calling thread and hands out
+ * blocks until replay_cancel_async is called, looping at the end of the
+ * recording.
+ */
+int replay_read_async(replay rp,
+		      rtlsdr_read_async_cb_t cb,
+		      void * ctx,
+		      uint32_t buf_len)
+{
+  struct timespec deadline, now, pass_start;
+  size_t offset = 0;
+  size_t len;
+  uint64_t pass_samples = 0;
+  double dt;
+
+  if (buf_len == 0) { buf_len = REPLAY_DEFAULT_BUFFER_LENGTH; }
+
+  clock_gettime(CLOCK_MONOTONIC, & deadline);
+  pass_start = deadline;
+
+  while ( ! _replay_is_cancelled(rp)) {
+    len = rp->size - offset;
+    if (len > buf_len) { len = buf_len; }
+
+    if (rp->paced) {
+      // fell more than a second behind (e.g. stalled), don't try to catch up
+      clock_gettime(CLOCK_MONOTONIC, & now);
+      if (_replay_timespec_diff( & now, & deadline) > 1.0) { deadline = now; }
+
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, & deadline, NULL);
+
+      _replay_timespec_add( & deadline,
+			    (len / 2) / (double) replay_get_sample_rate(rp));
+    }
+
+    cb(rp->data + offset, (uint32_t) len, ctx);
+
+    offset += len;
+    pass_samples += len / 2;
+
+    // end of recording, report how fast we got through it and start over
+    if (offset >= rp->size) {
+      clock_gettime(CLOCK_MONOTONIC, & now);
+      dt = _replay_timespec_diff( & now, & pass_start);
+
+      DEBUG("Replayed %llu samples in %0.2f s (%0.1f ksamples/s).\n",
+	    (unsigned long long) pass_samples, dt,
+	    dt > 0.0 ? pass_samples / dt / 1e3 : 0.0);
+
+      offset = 0;
+      pass_samples = 0;
+      pass_start = now;
+    }
+  }
+
+  return 0;
+}
+
+int replay_cancel_async(replay rp)
+{
+  pthread_mutex_lock( & rp->common_m);
+  rp->common.cancelled = true;
+  pthread_mutex_unlock( & rp->common_m);
+  return 0;
+}
+
+bool replay_is_paced(replay rp)
+{
+  return rp->paced;
+}
+
+uint32_t replay_get_center_freq(replay rp)
+{
+  uint32_t center_freq;
+  pthread_mutex_lock( & rp->common_m);
+  center_freq = rp->common.center_freq;
+  pthread_mutex_unlock( & rp->common_m);
+  return center_freq;
+}
+
+/**
+ * The recording can't be retuned; we just remember the frequency so the
+ * rest of the application sees what it asked for.
+ */
+int replay_set_center_freq(replay rp, uint32_t center_freq)
+{
+  pthread_mutex_lock( & rp->common_m);
+  rp->common.center_freq = center_freq;
+  pthread_mutex_unlock( & rp->common_m);
+  return 0;
+}
+
+uint32_t replay_get_sample_rate(replay rp)
+{
+  uint32_t sample_rate;
+  pthread_mutex_lock( & rp->common_m);
+  sample_rate = rp->common.sample_rate;
+  pthread_mutex_unlock( & rp->common_m);
+  return sample_rate;
+}
+
+/**
+ * Raw .bin recordings carry no rate, so whatever is set here is taken to be
+ * the rate they were captured at (and paced accordingly). SigMF recordings
+ * keep the rate from their metadata.
+ */
+int replay_set_sample_rate(replay rp, uint32_t sample_rate)
+{
+  if (rp->sample_rate_fixed) { return 0; }
+
+  pthread_mutex_lock( & rp->common_m);
+  rp->common.sample_rate = sample_rate;
+  pthread_mutex_unlock( & rp->common_m);
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "ring.h"
+
+struct ring_slot_s
+{
+  struct ring_block_s block;
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+struct ring_s
+{
+  // written only by the producer
+  atomic_uint tail __attribute__ ((aligned (CACHE_LINE_SIZE)));
+  uint32_t seq;
+  atomic_uint overruns;
+
+  // written only by the consumer
+  atomic_uint head __attribute__ ((aligned (CACHE_LINE_SIZE)));
+  bool starved;
+  atomic_uint underruns;
+
+  // read-only after creation
+  unsigned int depth __attribute__ ((aligned (CACHE_LINE_SIZE)));
+  unsigned int mask;
+  size_t block_size;
+  struct ring_slot_s * slots;
+  void * data;
+};
+
+ring ring_create(unsigned int depth, size_t block_size)
+{
+  ring rb;
+  unsigned int i;
+
+  if (posix_memalign((void **) & rb, CACHE_LINE_SIZE, sizeof(struct ring_s))) {
+    ERROR("Failed to allocate ring.\n");
+    exit(1);
+  }
+
+  // round up to a power of two so the free-running indexes wrap cleanly
+  rb->depth = 1;
+  while (rb->depth < depth) { rb->depth <<= 1; }
+
+  rb->mask = rb->depth - 1;
+
+  // keep every block's storage on its own cache lines
+  rb->block_size = (block_size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+  if (posix_memalign((void **) & rb->slots, CACHE_LINE_SIZE,
+		     rb->depth * sizeof(struct ring_slot_s)) ||
+      posix_memalign( & rb->data, CACHE_LINE_SIZE,
+		     rb->depth * rb->block_size)) {
+    ERROR("Failed to allocate ring storage.\n");
+    exit(1);
+  }
+
+  for (i = 0; i < rb->depth; i++) {
+    rb->slots[i].block.seq = 0;
+    rb->slots[i].block.tag = 0;
+    rb->slots[i].block.size = 0;
+    rb->slots[i].block.data = (char *) rb->data + i * rb->block_size;
+  }
+
+  atomic_init( & rb->head, 0);
+  atomic_init( & rb->tail, 0);
+  atomic_init( & rb->overruns, 0);
+  atomic_init( & rb->underruns, 0);
+
+  rb->seq = 0;
+  rb->starved = false;
+
+  return rb;
+}
+
+void ring_destroy(ring rb)
+{
+  free(rb->data);
+  free(rb->slots);
+  free(rb);
+}
+
+/**
+ * Producer side. Returns the next free block, or NULL (counting an overrun)
+ * if the consumer hasn't caught up. Either way a sequence number is used.
+ */
+struct ring_block_s * ring_acquire(ring rb)
+{
+  unsigned int tail = atomic_load_explicit( & rb->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit( & rb->head, memory_order_acquire);
+
+  uint32_t seq = rb->seq++;
+
+  if (tail - head >= rb->depth) {
+    atomic_fetch_add_explicit( & rb->overruns, 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  struct ring_block_s * block = & rb->slots[tail & rb->mask].block;
+  block->seq = seq;
+  block->tag = 0;
+  block->size = 0;
+
+  return block;
+}
+
+void ring_commit(ring rb)
+{
+  unsigned int tail = atomic_load_explicit( & rb->tail, memory_order_relaxed);
+  atomic_store_explicit( & rb->tail, tail + 1, memory_order_release);
+}
+
+bool ring_push(ring rb, void * buf, size_t size, uint32_t tag)
+{
+  struct ring_block_s * block = ring_acquire(rb);
+
+  if (block == NULL) { return false; }
+
+  if (size > rb->block_size) { size = rb->block_size; }
+
+  memcpy(block->data, buf, size);
+  block->size = size;
+  block->tag = tag;
+
+  ring_commit(rb);
+
+  return true;
+}
+
+/**
+ * Consumer side. Returns the oldest committed block without removing it, or
+ * NULL if there is none. An underrun is counted once per stretch of empty
+ * polls, not once per poll.
+ */
+struct ring_block_s * ring_peek(ring rb)
+{
+  unsigned int head = atomic_load_explicit( & rb->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit( & rb->tail, memory_order_acquire);
+
+  if (head == tail) {
+    if ( ! rb->starved) {
+      atomic_fetch_add_explicit( & rb->underruns, 1, memory_order_relaxed);
+      rb->starved = true;
+    }
+
+    return NULL;
+  }
+
+  rb->starved = false;
+
+  return & rb->slots[head & rb->mask].block;
+}
+
+void ring_release(ring rb)
+{
+  unsigned int head = atomic_load_explicit( & rb->head, memory_order_relaxed);
+  atomic_store_explicit( & rb->head, head + 1, memory_order_release);
+}
+
+bool ring_is_full(ring rb)
+{
+  return atomic_load_explicit( & rb->tail, memory_order_acquire) -
+    atomic_load_explicit( & rb->head, memory_order_acquire) >= rb->depth;
+}
+
+unsigned int ring_get_overruns(ring rb)
+{
+  return atomic_load_explicit( & rb->overruns, memory_order_relaxed);
+}
+
+unsigned int ring_get_underruns(ring rb)
+{
+  return atomic_load_explicit( & rb->underruns, memory_order_relaxed);
+}
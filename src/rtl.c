@@ -1,12 +1,20 @@
 #include <pthread.h>
 #include <rtl-sdr.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "macros.h"
+#include "replay.h"
 #include "rtl.h"
 
+// after the tuner's told to change, its PLL takes a moment to lock
+#define RTL_TUNE_SETTLE 0.005 /* s */
+
 typedef enum { RTL_HALTED, RTL_RUNNING, RTL_EXITING } rtl_state;
 
 struct rtl_s
@@ -20,18 +28,22 @@ struct rtl_s
   rtlsdr_dev_t * device;
   int device_index;
 
+  // recording standing in for the device, if any (device is NULL then)
+  replay rp;
+
   // called whenever samples are received from the RTL
   rtl_execute_callback execute_callback;
   void * execute_ctx;
 
-  // buffer for samples received from the RTL
-  int8_t buffer[RTL_MAX_BUFFER_LENGTH];
-  int buffer_len;
-  pthread_mutex_t buffer_m;
-
   // our own record of parameters otherwise hidden by librtlsdr
   int center_freq_correction;
   uint32_t sample_rate;
+
+  // bumped whenever the frequency or rate changes, after noting when (ns,
+  // CLOCK_MONOTONIC); buffers still in flight from before keep the old one
+  atomic_uint tune_gen;
+  atomic_ullong tune_time;
+  uint32_t delivered_gen; // only touched by the async thread
 };
 
 rtl_state _rtl_get_state(rtl r)
@@ -87,27 +99,54 @@ int _rtl_search_for_device(char * s)
   return -1;
 }
 
+static uint64_t _rtl_now()
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, & time);
+
+  return (uint64_t) time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+static void _rtl_retuned(rtl r)
+{
+  atomic_store( & r->tune_time, _rtl_now());
+  atomic_fetch_add( & r->tune_gen, 1);
+}
+
+/**
+ * A buffer belongs to the latest tuning once all of it was captured after
+ * the tuner settled, i.e. it's arrived at least its own length after.
+ * Recordings don't have anything in flight.
+ */
+static uint32_t _rtl_get_buffer_tune_gen(rtl r, uint32_t len)
+{
+  uint32_t gen = atomic_load( & r->tune_gen);
+  uint32_t fs;
+  double elapsed, span;
+
+  if (gen == r->delivered_gen) { return gen; }
+
+  fs = rtl_get_sample_rate(r);
+  elapsed = (_rtl_now() - atomic_load( & r->tune_time)) / 1e9;
+  span = fs > 0 ? len / 2.0 / fs : 0.0;
+
+  if ( ! rtl_is_realtime(r) || elapsed >= span + RTL_TUNE_SETTLE) {
+    r->delivered_gen = gen; }
+
+  return r->delivered_gen;
+}
+
 static void _rtl_read_async_callback(unsigned char * buf, uint32_t len, void * ctx)
 {
   rtl r = (rtl) ctx;
 
   if ( ! ctx || _rtl_get_state(r) == RTL_EXITING) { return; }
   
-  pthread_mutex_lock( & r->buffer_m);
-  
-  r->buffer_len = (int) len;
-  
-  int i;
-  
-  for (i = 0; i < len; i++) {
-    r->buffer[i] = ((int8_t) buf[i]) + 128;
-    // r->buffer[i] = ((int16_t) buf[i]) - 127;
-  }
-  
-  // invoke callback
-  r->execute_callback(r->buffer, r->buffer_len, r->execute_ctx);
-  
-  pthread_mutex_unlock( & r->buffer_m);
+  // hand over the samples untouched, the consumer converts them (see
+  // convert_u8_to_cf) on its own copy
+  r->execute_callback((uint8_t *) buf, (int) len,
+		      _rtl_get_buffer_tune_gen(r, len), r->execute_ctx);
 }
 
 static void * _rtl_thread_fn(void * arg)
@@ -115,7 +154,12 @@ static void * _rtl_thread_fn(void * arg)
   rtl r = (rtl) arg;
 
   // this takes over thread
-  rtlsdr_read_async(r->device, _rtl_read_async_callback, (void *) r, 0, 0);
+  if (r->rp != NULL) {
+    replay_read_async(r->rp, _rtl_read_async_callback, (void *) r, 0);
+  }
+  else {
+    rtlsdr_read_async(r->device, _rtl_read_async_callback, (void *) r, 0, 0);
+  }
 
   // async canceled, spin until we're supposed to exit
   while (_rtl_get_state(r) != RTL_EXITING) {
@@ -147,28 +191,57 @@ rtl rtl_create(int device_index)
     exit(1);
   }
 
+  r->rp = NULL;
   r->sample_rate = RTL_DEFAULT_SAMPLE_RATE;
   r->state = RTL_HALTED;
 
-  pthread_mutex_init( & r->buffer_m, NULL);
+  atomic_init( & r->tune_gen, 0);
+  atomic_init( & r->tune_time, _rtl_now());
+  r->delivered_gen = 0;
+
   pthread_mutex_init( & r->state_m, NULL);
   
   return r;
 }
 
+/**
+ * Like rtl_create, but samples come from a recording instead of a dongle.
+ * If paced is false blocks are delivered as fast as they're consumed.
+ */
+rtl rtl_create_replay(const char * path, bool paced)
+{
+  rtl r = (rtl) malloc(sizeof(struct rtl_s));
+
+  r->device = NULL;
+  r->device_index = -1;
+  r->rp = replay_open(path, paced);
+  r->sample_rate = replay_get_sample_rate(r->rp);
+  r->state = RTL_HALTED;
+
+  atomic_init( & r->tune_gen, 0);
+  atomic_init( & r->tune_time, _rtl_now());
+  r->delivered_gen = 0;
+
+  pthread_mutex_init( & r->state_m, NULL);
+
+  return r;
+}
+
 void rtl_destroy(rtl r)
 {
   DEBUG("Destroying rtl...\n");
   
   _rtl_set_state(r, RTL_EXITING);
   
-  rtlsdr_cancel_async(r->device);
+  if (r->rp != NULL) { replay_cancel_async(r->rp); }
+  else { rtlsdr_cancel_async(r->device); }
   
   pthread_join(r->thread, NULL);
-  pthread_mutex_destroy( & r->buffer_m);
   pthread_mutex_destroy( & r->state_m);
   
-  rtlsdr_close(r->device);
+  if (r->rp != NULL) { replay_close(r->rp); }
+  else { rtlsdr_close(r->device); }
+
   free(r);
 }
 
@@ -185,9 +258,30 @@ void rtl_execute(rtl r, rtl_execute_callback cb, void * ctx)
   pthread_create( & r->thread, NULL, _rtl_thread_fn, (void *) r);
 }
 
+/**
+ * False if samples may arrive faster than real time (a free-running replay),
+ * in which case consumers should apply backpressure rather than drop.
+ */
+bool rtl_is_realtime(rtl r)
+{
+  return r->rp == NULL || replay_is_paced(r->rp);
+}
+
+/**
+ * Counts retunes and rate changes; samples are tagged with the one they
+ * were captured under, so consumers can tell them from ones still in flight.
+ */
+uint32_t rtl_get_tune_gen(rtl r)
+{
+  return atomic_load( & r->tune_gen);
+}
+
 int rtl_reset_buffer(rtl r)
 {
   int status;
+
+  if (r->rp != NULL) { return 0; }
+
   status = rtlsdr_reset_buffer(r->device);
   
   if (status < 0) {
@@ -199,18 +293,27 @@ int rtl_reset_buffer(rtl r)
 
 uint32_t rtl_get_center_freq(rtl r)
 {
+  if (r->rp != NULL) { return replay_get_center_freq(r->rp); }
+
   return rtlsdr_get_center_freq(r->device);
 }
 
 int rtl_set_center_freq(rtl r, uint32_t center_freq)
 {
   int status;
-  status = rtlsdr_set_center_freq(r->device, center_freq);
+
+  if (r->rp != NULL) {
+    status = replay_set_center_freq(r->rp, center_freq);
+  }
+  else {
+    status = rtlsdr_set_center_freq(r->device, center_freq);
+  }
   
   if (status < 0) {
     ERROR("Failed to set center frequency.\n");
   }
   else {
+    _rtl_retuned(r);
     DEBUG("Tuned to %u Hz.\n", center_freq);
   }
 
@@ -220,6 +323,9 @@ int rtl_set_center_freq(rtl r, uint32_t center_freq)
 int rtl_set_auto_gain(rtl r)
 {
   int status;
+
+  if (r->rp != NULL) { return 0; }
+
   status = rtlsdr_set_tuner_gain_mode(r->device, 0);
 
   if (status != 0) {
@@ -235,6 +341,9 @@ int rtl_set_auto_gain(rtl r)
 int rtl_set_freq_correction(rtl r, int ppm_error)
 {
   int status;
+
+  if (r->rp != NULL) { return 0; }
+
   status = rtlsdr_set_freq_correction(r->device, ppm_error);
 
   if (status < 0) {
@@ -250,6 +359,9 @@ int rtl_set_freq_correction(rtl r, int ppm_error)
 int rtl_set_gain_mode(rtl r, int gain)
 {
   int status;
+
+  if (r->rp != NULL) { return 0; }
+
   status = rtlsdr_set_tuner_gain_mode(r->device, 1);
   
   if (status < 0) {
@@ -271,18 +383,27 @@ int rtl_set_gain_mode(rtl r, int gain)
 
 uint32_t rtl_get_sample_rate(rtl r)
 {
+  if (r->rp != NULL) { return replay_get_sample_rate(r->rp); }
+
   return rtlsdr_get_sample_rate(r->device);
 }
 
 int rtl_set_sample_rate(rtl r, uint32_t sample_rate)
 {
   int status;
-  status = rtlsdr_set_sample_rate(r->device, sample_rate);
+
+  if (r->rp != NULL) {
+    status = replay_set_sample_rate(r->rp, sample_rate);
+  }
+  else {
+    status = rtlsdr_set_sample_rate(r->device, sample_rate);
+  }
   
   if (status < 0) {
     ERROR("Failed to set sample rate.\n");
   }
   else {
+    _rtl_retuned(r);
     DEBUG("Sampling at %u S/s.\n", sample_rate);
   }
 
@@ -3,14 +3,40 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "config.h"
 #include "macros.h"
 #include "scanner.h"
+#include "seqlock.h"
+#include "stationcache.h"
 
 #define THRESHOLD_AM 3.0f
 #define THRESHOLD_FM 8.0f /* dB */
 
+// a channel's decided once its SNR is this many standard errors (plus a
+// margin) clear of the threshold, or there've been enough estimates
+#define SCANNER_MIN_ESTIMATES 2
+#define SCANNER_MAX_ESTIMATES 16
+#define SCANNER_CONFIDENCE 2.0f
+#define SCANNER_MARGIN 1.0f /* dB */
+
+// gives up on samples for a channel arriving (e.g. a stalled source)
+#define SCANNER_MAX_DWELL 0.5f /* s */
+
+// changes to the station cache are written out at most this often
+#define SCANNER_SAVE_INTERVAL 5.0f /* s */
+
+// wideband scans capture as much of the band at once as the dongle allows and
+// score every channel in it from the input spectrum
+#define SCANNER_WIDE_RATE 2400000 /* Hz */
+#define SCANNER_WIDE_USABLE 0.8f /* of the capture, the rest is filter skirts */
+#define SCANNER_WIDE_ESTIMATES 4 /* averaged per capture */
+#define SCANNER_WIDE_MAX_DWELL 1.0f /* s */
+#define SCANNER_WIDE_MAX_BINS 4096
+#define SCANNER_DC_BINS 2 /* either side of DC, where the tuner's LO leaks */
+
 struct scanner_common_s
 {
   scanner_mode mode;
@@ -23,12 +49,68 @@ struct scanner_common_s
   struct timespec tune_time;
 };
 
+/**
+ * A wideband scan in progress, only touched by scanner_execute.
+ */
+struct scanner_sweep_s
+{
+  bool active;
+  demod_mode mode;
+
+  // what to go back to
+  int fc;
+  int fs;
+
+  int next; // lowest channel not scored yet
+  int best; // strongest station so far
+  float best_snr;
+
+  // estimates of the current capture, only counted from samples taken after
+  // it was tuned
+  uint32_t tune_gen;
+  struct timespec tune_time;
+  unsigned int num_estimates; // last seen from the demod
+  unsigned int num_averaged;
+  unsigned int num_bins;
+
+  float power[SCANNER_WIDE_MAX_BINS]; // dB
+  float accum[SCANNER_WIDE_MAX_BINS]; // linear
+  float sorted[SCANNER_WIDE_MAX_BINS];
+};
+
 struct scanner_s
 {
+  // read without locking (see _scanner_get_common)
   struct scanner_common_s common;
-  pthread_mutex_t common_m;
+  struct seqlock_s common_lock;
+
+  struct scanner_sweep_s sweep;
+
+  // tuning the current channel's being judged on (see rtl_get_tune_gen),
+  // and whether a seek jumped there from the station cache, only touched by
+  // scanner_execute
+  uint32_t tune_gen;
+  bool seek_jumped;
+
+  // stations found, kept in stations_path (if set) between runs
+  stationcache stations;
+  char * stations_path;
+  struct timespec save_time;
+
+  // held from deciding on a retune until it's done
+  pthread_mutex_t tune_m;
 };
 
+static void _scanner_get_common(scanner scan, struct scanner_common_s * common)
+{
+  unsigned int seq;
+
+  do {
+    seq = seqlock_read_begin( & scan->common_lock);
+    * common = scan->common;
+  } while (seqlock_read_retry( & scan->common_lock, seq));
+}
+
 scanner scanner_create()
 {
   scanner scan = (scanner) malloc(sizeof(struct scanner_s));
@@ -39,23 +121,319 @@ scanner scanner_create()
   scan->common.tune_time.tv_sec = (time_t) 0;
   scan->common.tune_time.tv_nsec = 0;
 
-  pthread_mutex_init( & scan->common_m, NULL);
+  seqlock_init( & scan->common_lock);
+  pthread_mutex_init( & scan->tune_m, NULL);
+
+  scan->sweep.active = false;
+  scan->tune_gen = 0;
+  scan->seek_jumped = false;
+
+  scan->stations = stationcache_create();
+  scan->stations_path = NULL;
+  clock_gettime(CLOCK_REALTIME_COARSE, & scan->save_time);
 
   return scan;
 }
 
 void scanner_destroy(scanner scan)
 {
-  pthread_mutex_destroy( & scan->common_m);
+  seqlock_destroy( & scan->common_lock);
+  pthread_mutex_destroy( & scan->tune_m);
+
+  if (scan->stations_path != NULL && stationcache_is_dirty(scan->stations)) {
+    stationcache_save(scan->stations, scan->stations_path); }
+
+  stationcache_destroy(scan->stations);
+  free(scan->stations_path);
 
   free(scan);
 }
 
-void scanner_execute(scanner scan, demod dem, rtl r)
+/**
+ * Loads the station cache from path (if it's there) and keeps it there from
+ * now on.
+ */
+void scanner_set_stations_path(scanner scan, const char * path)
 {
-  scanner_mode smode = scanner_get_mode(scan);
-  if (smode == SCANNER_OFF) return;
+  free(scan->stations_path);
+  scan->stations_path = strdup(path);
+
+  stationcache_load(scan->stations, path);
+}
 
+// scannable range and channel grid for a mode (these should really be defined
+// somewhere)
+static void _scanner_get_band(demod_mode mode, int * fmin, int * fmax,
+			      int * foffset)
+{
+  * fmax = mode == DEMOD_AM ? 1700e3 : 107.9e6;
+  * fmin = mode == DEMOD_AM ? 540e3 : 87.9e6;
+  * foffset = mode == DEMOD_AM ? (int) 125e6 : 0;
+}
+
+static float _scanner_elapsed(const struct timespec * since)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_REALTIME_COARSE, & time);
+
+  return (time.tv_sec - since->tv_sec) + (time.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static int _scanner_compare_floats(const void * a, const void * b)
+{
+  float x = * (const float *) a, y = * (const float *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Tunes the capture so the next channel to score sits just inside its usable
+ * band.
+ */
+static void _scanner_sweep_tune(scanner scan, demod dem, rtl r)
+{
+  struct scanner_sweep_s * sweep = & scan->sweep;
+  int fmin, fmax, foffset;
+  int fs = (int) rtl_get_sample_rate(r);
+  int half = demod_lookup_frequency_step(sweep->mode) / 2;
+  int fc = sweep->next - half + (int) (SCANNER_WIDE_USABLE * fs / 2);
+
+  _scanner_get_band(sweep->mode, & fmin, & fmax, & foffset);
+
+  demod_set_center_freq(dem, fc);
+  rtl_set_center_freq(r, fc + foffset);
+
+  sweep->tune_gen = rtl_get_tune_gen(r);
+  sweep->num_estimates = 0;
+  sweep->num_averaged = 0;
+  clock_gettime(CLOCK_REALTIME_COARSE, & sweep->tune_time);
+
+  demod_execute(dem);
+}
+
+static void _scanner_sweep_begin(scanner scan, demod dem, rtl r)
+{
+  struct scanner_sweep_s * sweep = & scan->sweep;
+  int fmax, foffset;
+
+  sweep->mode = demod_get_mode(dem);
+  sweep->fc = demod_get_center_freq(dem);
+  sweep->fs = (int) rtl_get_sample_rate(r);
+  sweep->best = -1;
+  sweep->best_snr = 0.0f;
+  sweep->active = true;
+
+  _scanner_get_band(sweep->mode, & sweep->next, & fmax, & foffset);
+
+  DEBUG("Wideband scan from %d to %d Hz.\n", sweep->next, fmax);
+
+  // as wide as it goes (the source may not honor it, e.g. a recording)
+  rtl_set_sample_rate(r, SCANNER_WIDE_RATE);
+  demod_set_input_rate(dem, rtl_get_sample_rate(r));
+  demod_set_wideband_spectrum(dem, true);
+
+  _scanner_sweep_tune(scan, dem, r);
+}
+
+static void _scanner_sweep_end(scanner scan, demod dem, rtl r)
+{
+  struct scanner_sweep_s * sweep = & scan->sweep;
+  int fmin, fmax, foffset;
+
+  _scanner_get_band(sweep->mode, & fmin, & fmax, & foffset);
+
+  rtl_set_sample_rate(r, sweep->fs);
+  demod_set_input_rate(dem, rtl_get_sample_rate(r));
+  demod_set_wideband_spectrum(dem, false);
+
+  demod_set_center_freq(dem, sweep->fc);
+  rtl_set_center_freq(r, sweep->fc + foffset);
+
+  demod_execute(dem);
+
+  sweep->active = false;
+
+  // done, unless it's been switched to something else in the meantime
+  seqlock_write_begin( & scan->common_lock);
+
+  if (scan->common.mode == SCANNER_WIDE) { scan->common.mode = SCANNER_OFF; }
+  if (sweep->best > 0) { scan->common.last_station_found = sweep->best; }
+
+  seqlock_write_end( & scan->common_lock);
+}
+
+/**
+ * Scores every channel in the usable part of the capture: the average power
+ * over the signal's bandwidth against the median bin (the noise floor).
+ * Returns the next channel to score.
+ */
+static int _scanner_sweep_score(scanner scan, demod dem, unsigned int n)
+{
+  struct scanner_sweep_s * sweep = & scan->sweep;
+  int fmin, fmax, foffset;
+  int fc = (int) demod_get_center_freq(dem);
+  int fs = demod_get_input_rate(dem);
+  int step = demod_lookup_frequency_step(sweep->mode);
+  int usable = (int) (SCANNER_WIDE_USABLE * fs / 2);
+  float bw = sweep->mode == DEMOD_AM ? 3e3f : 75e3f; // either side
+  float thresh = sweep->mode == DEMOD_AM ? THRESHOLD_AM : THRESHOLD_FM;
+  float noise, sum, snr;
+  int f, lo, hi, i, k, m;
+
+  _scanner_get_band(sweep->mode, & fmin, & fmax, & foffset);
+
+  // noise floor, from the bins inside the usable band
+  lo = (int) n / 2 - (int) ((float) usable / fs * n);
+  hi = (int) n / 2 + (int) ((float) usable / fs * n);
+  if (lo < 0) { lo = 0; }
+  if (hi > (int) n) { hi = (int) n; }
+
+  for (i = lo, m = 0; i < hi; i++) { sweep->sorted[m++] = sweep->power[i]; }
+  qsort(sweep->sorted, m, sizeof(float), _scanner_compare_floats);
+  noise = powf(10.0f, sweep->sorted[m / 2] / 10.0f);
+
+  for (f = sweep->next; f <= fmax && f + step / 2 <= fc + usable; f += step) {
+    lo = (int) n / 2 + (int) floorf((f - bw - fc) / (float) fs * n);
+    hi = (int) n / 2 + (int) ceilf((f + bw - fc) / (float) fs * n);
+
+    for (i = lo, k = 0, sum = 0.0f; i <= hi; i++) {
+      if (i < 0 || i >= (int) n || abs(i - (int) n / 2) <= SCANNER_DC_BINS) {
+	continue; }
+
+      sum += powf(10.0f, sweep->power[i] / 10.0f);
+      k++;
+    }
+
+    if (k == 0) { continue; }
+
+    snr = 10.0f * log10f(sum / k / noise);
+
+    stationcache_update(scan->stations, sweep->mode, f, snr, snr >= thresh);
+
+    if (snr >= thresh) {
+      if (sweep->best < 0 || snr > sweep->best_snr) {
+	sweep->best = f;
+	sweep->best_snr = snr;
+      }
+    }
+  }
+
+  return f;
+}
+
+/**
+ * Adds the latest spectrum estimate to the capture's average, if there's a
+ * new one from samples taken since it was tuned.
+ */
+static void _scanner_sweep_accumulate(scanner scan, demod dem)
+{
+  struct scanner_sweep_s * sweep = & scan->sweep;
+  float mean, deviation;
+  unsigned int n, i;
+
+  n = demod_get_snr_stats(dem, sweep->tune_gen, & mean, & deviation);
+  if (n <= sweep->num_estimates) { return; }
+
+  sweep->num_estimates = n;
+
+  n = demod_get_spectrum(dem, sweep->power, SCANNER_WIDE_MAX_BINS);
+  if (n == 0) { return; }
+
+  if (sweep->num_averaged == 0 || n != sweep->num_bins) {
+    memset(sweep->accum, 0, n * sizeof(float));
+    sweep->num_averaged = 0;
+    sweep->num_bins = n;
+  }
+
+  for (i = 0; i < n; i++) {
+    sweep->accum[i] += powf(10.0f, sweep->power[i] / 10.0f); }
+
+  sweep->num_averaged++;
+}
+
+/**
+ * Steps a wideband scan along: averages a few spectrum estimates of each
+ * capture, from samples taken once it's tuned, and scores the channels in
+ * it, then moves on.
+ */
+static void _scanner_sweep(scanner scan, bool scanning, demod dem, rtl r)
+{
+  struct scanner_sweep_s * sweep = & scan->sweep;
+  int fmin, fmax, foffset;
+  bool timed_out;
+  unsigned int i;
+
+  if ( ! sweep->active) {
+    if (scanning && demod_get_mode(dem) != DEMOD_NONE) {
+      _scanner_sweep_begin(scan, dem, r); }
+    return;
+  }
+
+  // stopped early
+  if ( ! scanning) {
+    _scanner_sweep_end(scan, dem, r);
+    return;
+  }
+
+  _scanner_sweep_accumulate(scan, dem);
+
+  timed_out = _scanner_elapsed( & sweep->tune_time) >= SCANNER_WIDE_MAX_DWELL;
+
+  if (sweep->num_averaged < SCANNER_WIDE_ESTIMATES && ! timed_out) { return; }
+
+  // nothing's coming through
+  if (sweep->num_averaged == 0) {
+    ERROR("No samples for the wideband scan, stopping.\n");
+    _scanner_sweep_end(scan, dem, r);
+    return;
+  }
+
+  for (i = 0; i < sweep->num_bins; i++) {
+    sweep->power[i] = 10.0f * log10f(sweep->accum[i] / sweep->num_averaged); }
+
+  sweep->next = _scanner_sweep_score(scan, dem, sweep->num_bins);
+
+  _scanner_get_band(sweep->mode, & fmin, & fmax, & foffset);
+
+  if (sweep->next > fmax) { _scanner_sweep_end(scan, dem, r); }
+  else { _scanner_sweep_tune(scan, dem, r); }
+}
+
+/**
+ * Whether there's enough to call a channel: the SNR's clear of the threshold
+ * by more than the estimates' spread can account for, or it's had long
+ * enough. A station that's been heard there before only needs confirming.
+ */
+static bool _scanner_is_decided(unsigned int n, float snr, float deviation,
+				float thresh, bool known)
+{
+  if (known && n > 0 && snr >= thresh) { return true; }
+  if (n < SCANNER_MIN_ESTIMATES) { return false; }
+  if (n >= SCANNER_MAX_ESTIMATES) { return true; }
+
+  return fabsf(snr - thresh) >=
+    SCANNER_CONFIDENCE * deviation / sqrtf((float) n) + SCANNER_MARGIN;
+}
+
+static void _scanner_save_stations(scanner scan)
+{
+  if (scan->stations_path == NULL ||
+      _scanner_elapsed( & scan->save_time) < SCANNER_SAVE_INTERVAL ||
+      ! stationcache_is_dirty(scan->stations)) {
+    return;
+  }
+
+  stationcache_save(scan->stations, scan->stations_path);
+  clock_gettime(CLOCK_REALTIME_COARSE, & scan->save_time);
+}
+
+/**
+ * Dwells on a channel until it can be called, then moves on to the next one
+ * when scanning or seeking. Called with tune_m held.
+ */
+static void _scanner_step(scanner scan, demod dem, rtl r)
+{
+  struct scanner_common_s common;
   struct timespec time;
   float dt;
 
@@ -63,8 +441,6 @@ void scanner_execute(scanner scan, demod dem, rtl r)
 
   demod_mode dmode = demod_get_mode(dem);
 
-  bool just_started = scan->common.fc < 0;
-  
   int fc = demod_get_center_freq(dem);
   int fstep = demod_get_frequency_step(dem);
   int foffset = dmode == DEMOD_AM ? (int) 125e6 : 0;
@@ -76,123 +452,229 @@ void scanner_execute(scanner scan, demod dem, rtl r)
 
   float thresh = dmode == DEMOD_AM ? THRESHOLD_AM : THRESHOLD_FM;
 
-  // last computed signal to noise ratio
-  float snr = demod_get_snr(dem);
+  // SNR measured on the channel since it was tuned (nothing still in flight
+  // from the one before)
+  float snr = 0.0f, deviation = 0.0f;
+  unsigned int num_estimates;
 
   bool wrapped = false;
+  bool retune = false;
+  bool known;
+  int dir;
 
+  int fc_from;
   int fc_next;
 
-  // ugh
-  struct timespec * tune_time = & scan->common.tune_time;
-  
-  pthread_mutex_lock( & scan->common_m);
+  // the update is worked out on a copy and published in one go
+  seqlock_lock( & scan->common_lock);
+
+  common = scan->common;
+
+  bool just_started = common.fc < 0;
+
+  dt = (time.tv_sec - common.tune_time.tv_sec);
+  dt += (time.tv_nsec - common.tune_time.tv_nsec) / 1e9;
+
+  // starting frequency, judged on what's already been measured there
+  if (just_started) {
+    common.fc = fc;
+    common.tune_time.tv_sec = time.tv_sec;
+    common.tune_time.tv_nsec = time.tv_nsec;
+    scan->tune_gen = rtl_get_tune_gen(r);
+    scan->seek_jumped = false;
+  }
 
-  dt = (time.tv_sec - tune_time->tv_sec);
-  dt += (time.tv_nsec - tune_time->tv_nsec) / 1e9;
+  int fc_initial = common.fc; 
 
-  // starting frequency
-  if (just_started) { scan->common.fc = fc; }
+  num_estimates = demod_get_snr_stats(dem, scan->tune_gen, & snr, & deviation);
 
-  int fc_initial = scan->common.fc; 
+  // a station heard before (a seek's usually jumped to it) only needs
+  // confirming
+  known = (common.mode == SCANNER_SEEK_UP ||
+	   common.mode == SCANNER_SEEK_DOWN) &&
+    stationcache_contains(scan->stations, dmode, fc);
 
-  // wait a tick for the SNR measurement to settle
-  if ( ! just_started && dt >= 0.5f) {
+  // dwell until the channel can be called one way or the other
+  if ( ! just_started &&
+       (_scanner_is_decided(num_estimates, snr, deviation, thresh, known) ||
+	dt >= SCANNER_MAX_DWELL)) {
 
     // mark time
-    scan->common.tune_time.tv_sec = time.tv_sec;
-    scan->common.tune_time.tv_nsec = time.tv_nsec;
+    common.tune_time.tv_sec = time.tv_sec;
+    common.tune_time.tv_nsec = time.tv_nsec;
     
-    switch (smode) {
+    switch (common.mode) {
     case SCANNER_ON:
       fc_next = fc + fstep;
       if (fc_next > fmax) { wrapped = true; fc_next = fmin; }
       
-      if (snr >= thresh) {
-	scan->common.last_station_found = fc;
-      }
+      if (snr >= thresh) { common.last_station_found = fc; }
+
+      // timed out without a single estimate, so nothing's known either way
+      if (num_estimates > 0) {
+	stationcache_update(scan->stations, dmode, fc, snr, snr >= thresh); }
     
       // done scanning
       if ((wrapped || fc < fc_initial) && fc_initial <= fc_next) {
-	scan->common.mode = SCANNER_OFF;
+	common.mode = SCANNER_OFF;
       }
 
-      demod_set_center_freq(dem, fc_next);
-      rtl_set_center_freq(r, fc_next + foffset);
+      retune = true;
     
       break;
     
     case SCANNER_SEEK_UP:
-      fc_next = fc + fstep;
-      if (fc_next > fmax) { wrapped = true; fc_next = fmin; }
-
-      if (snr >= thresh && (fc != fc_initial || wrapped)) {
-	scan->common.last_station_found = fc;
-	scan->common.mode = SCANNER_OFF;
+    case SCANNER_SEEK_DOWN:
+      dir = common.mode == SCANNER_SEEK_UP ? 1 : -1;
+
+      // where the seek started doesn't count
+      if (fc != fc_initial) {
+	if (num_estimates > 0) {
+	  stationcache_update(scan->stations, dmode, fc, snr, snr >= thresh); }
+
+	if (snr >= thresh) {
+	  common.last_station_found = fc;
+	  common.mode = SCANNER_OFF;
+	  break;
+	}
       }
-      else {
-	demod_set_center_freq(dem, fc_next);
-	rtl_set_center_freq(r, fc_next + foffset);
+
+      retune = true;
+
+      // straight to the next station heard before, where a short dwell
+      // confirms it (see _scanner_is_decided)
+      if (fc == fc_initial) {
+	fc_next = stationcache_find_next(scan->stations, dmode, fc, dir,
+					 & wrapped);
+
+	if ((scan->seek_jumped = fc_next >= 0)) { break; }
       }
-      
-      break;
-    
-    case SCANNER_SEEK_DOWN:
-      fc_next = fc - fstep;
+
+      // otherwise every channel in turn, from the start again if the station
+      // jumped to has gone quiet (there may be others before it)
+      fc_from = scan->seek_jumped ? fc_initial : fc;
+      scan->seek_jumped = false;
+
+      wrapped = false;
+      fc_next = fc_from + dir * fstep;
+      if (fc_next > fmax) { wrapped = true; fc_next = fmin; }
       if (fc_next < fmin) { wrapped = true; fc_next = fmax; }
-      
-      if (snr >= thresh && (fc != fc_initial || wrapped)) {
-	scan->common.last_station_found = fc;
-	scan->common.mode = SCANNER_OFF;
-      }
-      else {
-	demod_set_center_freq(dem, fc_next);
-	rtl_set_center_freq(r, fc_next + foffset);
+
+      // all the way around without finding anything (fc_initial needn't be
+      // on the grid, so it's enough to have gone past it), back to the start
+      if ((wrapped || dir * (fc_from - fc_initial) < 0) &&
+	  dir * (fc_next - fc_initial) >= 0) {
+	fc_next = fc_initial;
+	common.mode = SCANNER_OFF;
       }
-      
+
       break;
     
     default: break;
     }
   }
-  
-  pthread_mutex_unlock( & scan->common_m);
+
+  seqlock_publish_begin( & scan->common_lock);
+  scan->common = common;
+  seqlock_publish_end( & scan->common_lock);
+
+  seqlock_unlock( & scan->common_lock);
+
+  // retuning the dongle can take a while, so it's done after (tune_m still
+  // keeps scanner_set_mode and other retunes out until it's done)
+  if (retune) {
+    demod_set_center_freq(dem, fc_next);
+    rtl_set_center_freq(r, fc_next + foffset);
+    scan->tune_gen = rtl_get_tune_gen(r);
+
+    // as for any other retune (see demod_set_reset_on_retune)
+    demod_execute(dem);
+  }
+}
+
+void scanner_execute(scanner scan, demod dem, rtl r)
+{
+  struct scanner_common_s common;
+
+  _scanner_save_stations(scan);
+
+  // nothing to do most of the time, find out without locking
+  _scanner_get_common(scan, & common);
+
+  if (common.mode == SCANNER_OFF && ! scan->sweep.active) return;
+
+  // deciding where to go and going there can't be split by a mode change or
+  // a retune from elsewhere, or the scanner would undo it
+  pthread_mutex_lock( & scan->tune_m);
+
+  _scanner_get_common(scan, & common);
+
+  if (common.mode == SCANNER_WIDE || scan->sweep.active) {
+    _scanner_sweep(scan, common.mode == SCANNER_WIDE, dem, r); }
+  else if (common.mode != SCANNER_OFF) {
+    _scanner_step(scan, dem, r); }
+
+  pthread_mutex_unlock( & scan->tune_m);
+}
+
+/**
+ * Held around retuning from outside the scanner (see scanner_execute).
+ */
+void scanner_lock_tuning(scanner scan)
+{
+  pthread_mutex_lock( & scan->tune_m);
+}
+
+void scanner_unlock_tuning(scanner scan)
+{
+  pthread_mutex_unlock( & scan->tune_m);
 }
 
 static const char * _scanner_mode_names[] = {
   [SCANNER_ON] = "on",
   [SCANNER_OFF] = "off",
   [SCANNER_SEEK_UP] = "up",
-  [SCANNER_SEEK_DOWN] = "down"
+  [SCANNER_SEEK_DOWN] = "down",
+  [SCANNER_WIDE] = "wide"
 };
 
 int scanner_get_last_station_found(scanner scan)
 {
-  int station;
-  pthread_mutex_lock( & scan->common_m);
-  station = scan->common.last_station_found;
-  pthread_mutex_unlock( & scan->common_m);
-  return station;
+  struct scanner_common_s common;
+  _scanner_get_common(scan, & common);
+  return common.last_station_found;
+}
+
+/**
+ * Copies up to len of the stations found for a mode (Hz) into stations,
+ * returns the number copied.
+ */
+int scanner_get_stations(scanner scan, demod_mode mode, int * stations, int len)
+{
+  return stationcache_get(scan->stations, mode, stations, len);
 }
 
 scanner_mode scanner_get_mode(scanner scan)
 {
-  scanner_mode mode;
-  pthread_mutex_lock( & scan->common_m);
-  mode = scan->common.mode;
-  pthread_mutex_unlock( & scan->common_m);
-  return mode;
+  struct scanner_common_s common;
+  _scanner_get_common(scan, & common);
+  return common.mode;
 }
 
 void scanner_set_mode(scanner scan, scanner_mode mode)
 {
   DEBUG("Scanner set to %s\n", _scanner_mode_names[mode]);
+
+  // waits for a retune in progress, so it's not followed by another
+  pthread_mutex_lock( & scan->tune_m);
 	
-  pthread_mutex_lock( & scan->common_m);
+  seqlock_write_begin( & scan->common_lock);
   
   scan->common.mode = mode;
   scan->common.fc = -1;
   scan->common.last_station_found = -1;
   
-  pthread_mutex_unlock( & scan->common_m);
+  seqlock_write_end( & scan->common_lock);
+
+  pthread_mutex_unlock( & scan->tune_m);
 }
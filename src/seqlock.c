@@ -0,0 +1,72 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "seqlock.h"
+
+void seqlock_init(struct seqlock_s * sl)
+{
+  atomic_init( & sl->seq, 0);
+  pthread_mutex_init( & sl->write_m, NULL);
+}
+
+void seqlock_destroy(struct seqlock_s * sl)
+{
+  pthread_mutex_destroy( & sl->write_m);
+}
+
+/**
+ * Waits out a write in progress (they're only a few stores long) and returns
+ * the sequence number to check the copy against.
+ */
+unsigned int seqlock_read_begin(struct seqlock_s * sl)
+{
+  unsigned int seq;
+
+  while ((seq = atomic_load_explicit( & sl->seq, memory_order_acquire)) & 1);
+
+  return seq;
+}
+
+// whether the copy made since seqlock_read_begin may be torn
+bool seqlock_read_retry(struct seqlock_s * sl, unsigned int seq)
+{
+  atomic_thread_fence(memory_order_acquire);
+
+  return atomic_load_explicit( & sl->seq, memory_order_relaxed) != seq;
+}
+
+void seqlock_lock(struct seqlock_s * sl)
+{
+  pthread_mutex_lock( & sl->write_m);
+}
+
+void seqlock_unlock(struct seqlock_s * sl)
+{
+  pthread_mutex_unlock( & sl->write_m);
+}
+
+void seqlock_publish_begin(struct seqlock_s * sl)
+{
+  unsigned int seq = atomic_load_explicit( & sl->seq, memory_order_relaxed);
+  atomic_store_explicit( & sl->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+void seqlock_publish_end(struct seqlock_s * sl)
+{
+  unsigned int seq = atomic_load_explicit( & sl->seq, memory_order_relaxed);
+  atomic_store_explicit( & sl->seq, seq + 1, memory_order_release);
+}
+
+void seqlock_write_begin(struct seqlock_s * sl)
+{
+  seqlock_lock(sl);
+  seqlock_publish_begin(sl);
+}
+
+void seqlock_write_end(struct seqlock_s * sl)
+{
+  seqlock_publish_end(sl);
+  seqlock_unlock(sl);
+}
@@ -0,0 +1,380 @@
+#include <complex.h>
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "spectrum.h"
+
+// keeps log10 of an empty bin finite
+#define SPECTRUM_MIN_POWER 1e-20f
+
+struct spectrum_s
+{
+  unsigned int nfft;
+  unsigned int num_segments;
+
+  // FFT plan and its buffers, created once
+  fftplan plan;
+  float complex * in;
+  float complex * out;
+  float * window;
+
+  // decimated copy of the block being analyzed
+  float complex * samples;
+  unsigned int samples_cap;
+
+  // average of |X|^2 over the segments, FFT order
+  float * accum;
+
+  // settings, may be changed from other threads
+  atomic_uint cadence;
+  atomic_uint step;
+  _Atomic float bw;
+
+  // bumped by spectrum_reset; results are stale until they've been computed
+  // from a block fed after the latest reset
+  atomic_uint reset_gen;
+  atomic_uint published_gen;
+
+  unsigned int num_blocks;
+
+  // published results, guarded by a seqlock (odd while being written)
+  atomic_uint seq __attribute__ ((aligned (CACHE_LINE_SIZE)));
+  float snr;
+  float * power; // dB, ordered from -fs/2 to fs/2
+
+  // every SNR estimate since the last reset, for how far it can be trusted
+  unsigned int num_estimates;
+  float snr_sum;
+  float snr_sq_sum;
+};
+
+static float _spectrum_window(spectrum_window window, unsigned int i,
+			      unsigned int n)
+{
+  float t = 2.0f * M_PI * i / (float) (n - 1);
+
+  switch (window) {
+  case SPECTRUM_WINDOW_HANN:
+    return 0.5f - 0.5f * cosf(t);
+  case SPECTRUM_WINDOW_HAMMING:
+    return 0.54f - 0.46f * cosf(t);
+  case SPECTRUM_WINDOW_BLACKMAN_HARRIS:
+    return 0.35875f - 0.48829f * cosf(t) + 0.14128f * cosf(2*t)
+      - 0.01168f * cosf(3*t);
+  default:
+    return 1.0f;
+  }
+}
+
+spectrum spectrum_create(unsigned int nfft,
+			 unsigned int num_segments,
+			 spectrum_window window)
+{
+  spectrum sp;
+  unsigned int i;
+  float wsum = 0.0f;
+
+  if (posix_memalign((void **) & sp, CACHE_LINE_SIZE, sizeof(struct spectrum_s))) {
+    ERROR("Failed to allocate spectrum.\n");
+    exit(1);
+  }
+
+  if (num_segments < 1) { num_segments = 1; }
+
+  sp->nfft = nfft;
+  sp->num_segments = num_segments;
+
+  sp->in = (float complex *) malloc(nfft * sizeof(float complex));
+  sp->out = (float complex *) malloc(nfft * sizeof(float complex));
+  sp->window = (float *) malloc(nfft * sizeof(float));
+  sp->accum = (float *) malloc(nfft * sizeof(float));
+  sp->power = (float *) malloc(nfft * sizeof(float));
+
+  // enough for num_segments with 50% overlap
+  sp->samples_cap = nfft + (num_segments - 1) * (nfft / 2);
+  sp->samples = (float complex *) malloc(sp->samples_cap * sizeof(float complex));
+
+  sp->plan = fft_create_plan(nfft, sp->in, sp->out, LIQUID_FFT_FORWARD, 0);
+
+  // normalize the window so a full-scale tone reads 0 dB
+  for (i = 0; i < nfft; i++) {
+    sp->window[i] = _spectrum_window(window, i, nfft);
+    wsum += sp->window[i];
+  }
+
+  for (i = 0; i < nfft; i++) {
+    sp->window[i] /= wsum;
+    sp->power[i] = 10.0f * log10f(SPECTRUM_MIN_POWER);
+  }
+
+  atomic_init( & sp->cadence, 1);
+  atomic_init( & sp->step, 1);
+  atomic_init( & sp->bw, 0.0f);
+  atomic_init( & sp->reset_gen, 0);
+  atomic_init( & sp->published_gen, 0);
+  atomic_init( & sp->seq, 0);
+
+  sp->num_blocks = 0;
+  sp->num_estimates = 0;
+  sp->snr_sum = 0.0f;
+  sp->snr_sq_sum = 0.0f;
+  sp->snr = 0.0f;
+
+  return sp;
+}
+
+void spectrum_destroy(spectrum sp)
+{
+  fft_destroy_plan(sp->plan);
+
+  free(sp->in);
+  free(sp->out);
+  free(sp->window);
+  free(sp->samples);
+  free(sp->accum);
+  free(sp->power);
+  free(sp);
+}
+
+static void _spectrum_publish_begin(spectrum sp)
+{
+  unsigned int seq = atomic_load_explicit( & sp->seq, memory_order_relaxed);
+  atomic_store_explicit( & sp->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static void _spectrum_publish_end(spectrum sp)
+{
+  unsigned int seq = atomic_load_explicit( & sp->seq, memory_order_relaxed);
+  atomic_store_explicit( & sp->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * Feeds a block of n interleaved unsigned 8-bit IQ samples taken at fs. Only
+ * every cadence-th block is analyzed; returns true if the results were
+ * updated.
+ */
+bool spectrum_execute(spectrum sp, const uint8_t * x, unsigned int n, float fs)
+{
+  unsigned int cadence = atomic_load_explicit( & sp->cadence, memory_order_relaxed);
+  unsigned int step = atomic_load_explicit( & sp->step, memory_order_relaxed);
+  float bw = atomic_load_explicit( & sp->bw, memory_order_relaxed);
+
+  unsigned int nfft = sp->nfft;
+  unsigned int hop = nfft / 2;
+  unsigned int m, i, j, k, num_segments, num_bins;
+  float S = 0.0f, N = 0.0f, p;
+
+  unsigned int gen = atomic_load( & sp->reset_gen);
+  bool fresh = gen != atomic_load_explicit( & sp->published_gen,
+					    memory_order_relaxed);
+
+  // start over, analyzing this block
+  if (fresh) { sp->num_blocks = 0; }
+
+  if (sp->num_blocks++ % cadence != 0) { return false; }
+
+  // pick every step-th sample (no anti-aliasing, we only want levels)
+  m = n / step;
+  if (m > sp->samples_cap) { m = sp->samples_cap; }
+  if (m < nfft) { return false; }
+
+  for (i = 0, j = 0; i < m; i++, j += 2*step) {
+    sp->samples[i] = (((float) x[j]) - 128.0f) / 128.0f +
+      ((((float) x[j+1]) - 128.0f) / 128.0f) * _Complex_I;
+  }
+
+  num_segments = 1 + (m - nfft) / hop;
+
+  memset(sp->accum, 0, nfft * sizeof(float));
+
+  for (k = 0; k < num_segments; k++) {
+    for (i = 0; i < nfft; i++) {
+      sp->in[i] = sp->samples[k*hop + i] * sp->window[i];
+    }
+
+    fft_execute(sp->plan);
+
+    for (i = 0; i < nfft; i++) {
+      sp->accum[i] += crealf(sp->out[i])*crealf(sp->out[i]) +
+	cimagf(sp->out[i])*cimagf(sp->out[i]);
+    }
+  }
+
+  // bins either side of DC occupied by the signal
+  num_bins = (unsigned int) (bw / (fs / step) * nfft);
+  if (num_bins < 1) { num_bins = 1; }
+  if (num_bins > nfft / 4) { num_bins = nfft / 4; }
+
+  _spectrum_publish_begin(sp);
+
+  for (i = 0; i < nfft; i++) {
+    p = sp->accum[i] / num_segments;
+
+    if (i < num_bins || i > (nfft - num_bins)) { S += p; }
+    else { N += p; }
+
+    sp->power[(i + nfft/2) % nfft] = 10.0f * log10f(p + SPECTRUM_MIN_POWER);
+  }
+
+  S = S / (2 * num_bins - 1);
+  N = N / (nfft - (2 * num_bins - 1));
+
+  sp->snr = 10.0f * log10f((S + SPECTRUM_MIN_POWER) / (N + SPECTRUM_MIN_POWER));
+
+  if (fresh) {
+    sp->num_estimates = 0;
+    sp->snr_sum = 0.0f;
+    sp->snr_sq_sum = 0.0f;
+  }
+
+  sp->num_estimates++;
+  sp->snr_sum += sp->snr;
+  sp->snr_sq_sum += sp->snr * sp->snr;
+
+  _spectrum_publish_end(sp);
+
+  atomic_store( & sp->published_gen, gen);
+
+  return true;
+}
+
+/**
+ * Forget the current estimate (e.g. after retuning). Safe to call from any
+ * thread; getters report nothing (0 dB SNR) until the next block has been
+ * analyzed.
+ */
+void spectrum_reset(spectrum sp)
+{
+  atomic_fetch_add( & sp->reset_gen, 1);
+}
+
+static bool _spectrum_is_stale(spectrum sp)
+{
+  return atomic_load( & sp->published_gen) != atomic_load( & sp->reset_gen);
+}
+
+void spectrum_set_cadence(spectrum sp, unsigned int cadence)
+{
+  atomic_store( & sp->cadence, cadence > 0 ? cadence : 1);
+}
+
+void spectrum_set_step(spectrum sp, unsigned int step)
+{
+  atomic_store( & sp->step, step > 0 ? step : 1);
+}
+
+void spectrum_set_signal_bandwidth(spectrum sp, float bw)
+{
+  atomic_store( & sp->bw, bw);
+}
+
+unsigned int spectrum_get_size(spectrum sp)
+{
+  return sp->nfft;
+}
+
+float spectrum_get_snr(spectrum sp)
+{
+  unsigned int s1, s2;
+  float snr;
+
+  if (_spectrum_is_stale(sp)) { return 0.0f; }
+
+  do {
+    s1 = atomic_load_explicit( & sp->seq, memory_order_acquire);
+    snr = sp->snr;
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit( & sp->seq, memory_order_relaxed);
+  } while ((s1 & 1) || s1 != s2);
+
+  return snr;
+}
+
+/**
+ * Mean and standard deviation (dB) of the SNR estimates since the last reset,
+ * returns how many there are (0 if none, leaving mean and deviation alone).
+ */
+unsigned int spectrum_get_snr_stats(spectrum sp, float * mean, float * deviation)
+{
+  unsigned int s1, s2, n;
+  float sum, sq_sum, var;
+
+  if (_spectrum_is_stale(sp)) { return 0; }
+
+  do {
+    s1 = atomic_load_explicit( & sp->seq, memory_order_acquire);
+    n = sp->num_estimates;
+    sum = sp->snr_sum;
+    sq_sum = sp->snr_sq_sum;
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit( & sp->seq, memory_order_relaxed);
+  } while ((s1 & 1) || s1 != s2);
+
+  if (n == 0) { return 0; }
+
+  var = sq_sum / n - (sum / n) * (sum / n);
+
+  * mean = sum / n;
+  * deviation = var > 0.0f ? sqrtf(var) : 0.0f;
+
+  return n;
+}
+
+/**
+ * Copies up to n bins of the latest estimate (dB, -fs/2 to fs/2) into power.
+ * Returns the number of bins copied, 0 if there's no estimate since the last
+ * reset. If gen isn't NULL it's set to a number that changes with every new
+ * estimate.
+ */
+unsigned int spectrum_get_power(spectrum sp, float * power, unsigned int n,
+				unsigned int * gen)
+{
+  unsigned int s1, s2;
+
+  if (n > sp->nfft) { n = sp->nfft; }
+  if (_spectrum_is_stale(sp)) { return 0; }
+
+  do {
+    s1 = atomic_load_explicit( & sp->seq, memory_order_acquire);
+    memcpy(power, sp->power, n * sizeof(float));
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit( & sp->seq, memory_order_relaxed);
+  } while ((s1 & 1) || s1 != s2);
+
+  // two steps of the seqlock per estimate
+  if (gen != NULL) { * gen = s1 / 2; }
+
+  return n;
+}
+
+/**
+ * Averages (in linear power) each run of n/m bins into one, for a display
+ * that doesn't need the full resolution, then scales it to a byte. Bins are
+ * repeated if m is more than n.
+ */
+void spectrum_quantize(const float * power, unsigned int n, uint8_t * y,
+		       unsigned int m, float min_db, float max_db)
+{
+  float scale = 255.0f / (max_db - min_db);
+  float sum, v;
+  unsigned int i, j, lo, hi;
+
+  for (i = 0; i < m; i++) {
+    lo = (unsigned int) ((uint64_t) i * n / m);
+    hi = (unsigned int) ((uint64_t) (i + 1) * n / m);
+    if (hi <= lo) { hi = lo + 1; }
+
+    for (j = lo, sum = 0.0f; j < hi; j++) {
+      sum += powf(10.0f, power[j] / 10.0f); }
+
+    v = (10.0f * log10f(sum / (hi - lo) + SPECTRUM_MIN_POWER) - min_db) * scale;
+    y[i] = (uint8_t) (v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v + 0.5f);
+  }
+}
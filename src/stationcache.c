@@ -0,0 +1,371 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "macros.h"
+#include "stationcache.h"
+
+#define STATIONCACHE_MAGIC "RLSC"
+#define STATIONCACHE_VERSION 1
+#define STATIONCACHE_HEADER_SIZE 12
+#define STATIONCACHE_RECORD_SIZE 16
+
+#define STATIONCACHE_NUM_MODES (DEMOD_AM + 1)
+
+struct stationcache_entry_s
+{
+  int fc;
+  float snr;
+  time_t seen;
+};
+
+struct stationcache_s
+{
+  // sorted by frequency
+  struct stationcache_entry_s entries[STATIONCACHE_NUM_MODES][STATIONCACHE_SIZE];
+  int num_entries[STATIONCACHE_NUM_MODES];
+
+  // changed since it was last loaded or saved
+  bool dirty;
+
+  pthread_mutex_t m;
+};
+
+stationcache stationcache_create()
+{
+  stationcache sc = (stationcache) malloc(sizeof(struct stationcache_s));
+
+  memset(sc->num_entries, 0, sizeof(sc->num_entries));
+  sc->dirty = false;
+
+  pthread_mutex_init( & sc->m, NULL);
+
+  return sc;
+}
+
+void stationcache_destroy(stationcache sc)
+{
+  pthread_mutex_destroy( & sc->m);
+  free(sc);
+}
+
+static void _stationcache_put_u32(uint8_t * p, uint32_t v)
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+  p[2] = (uint8_t) (v >> 16);
+  p[3] = (uint8_t) (v >> 24);
+}
+
+static uint32_t _stationcache_get_u32(const uint8_t * p)
+{
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+    (uint32_t) p[3] << 24;
+}
+
+/**
+ * Index of fc in a mode's entries, or where it would go if it isn't there.
+ * The lock must be held.
+ */
+static int _stationcache_search(stationcache sc, demod_mode mode, int fc)
+{
+  int lo = 0, hi = sc->num_entries[mode], mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+
+    if (sc->entries[mode][mid].fc < fc) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+
+  return lo;
+}
+
+/**
+ * Adds or refreshes a station, making room by forgetting the one heard
+ * longest ago if it's full. The lock must be held.
+ */
+static void _stationcache_insert(stationcache sc, demod_mode mode, int fc,
+				 float snr, time_t seen)
+{
+  struct stationcache_entry_s * e = sc->entries[mode];
+  int n = sc->num_entries[mode];
+  int i = _stationcache_search(sc, mode, fc), j, oldest;
+
+  if (i == n || e[i].fc != fc) {
+    if (n == STATIONCACHE_SIZE) {
+      for (j = 1, oldest = 0; j < n; j++) {
+	if (e[j].seen < e[oldest].seen) { oldest = j; } }
+
+      memmove(e + oldest, e + oldest + 1, (n - oldest - 1) * sizeof(* e));
+      sc->num_entries[mode] = --n;
+
+      i = _stationcache_search(sc, mode, fc);
+    }
+
+    memmove(e + i + 1, e + i, (n - i) * sizeof(* e));
+    sc->num_entries[mode]++;
+  }
+
+  e[i].fc = fc;
+  e[i].snr = snr;
+  e[i].seen = seen;
+}
+
+/**
+ * Replaces the contents with a file's, returns false (leaving them alone) if
+ * it can't be read or isn't a station cache.
+ */
+bool stationcache_load(stationcache sc, const char * path)
+{
+  FILE * f = fopen(path, "rb");
+
+  uint8_t header[STATIONCACHE_HEADER_SIZE], record[STATIONCACHE_RECORD_SIZE];
+  struct stationcache_s * loaded;
+  uint32_t count, i, bits;
+  demod_mode mode;
+  float snr;
+  int num_stations = 0;
+
+  if (f == NULL) {
+    DEBUG("No station cache at %s.\n", path);
+    return false;
+  }
+
+  if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+      memcmp(header, STATIONCACHE_MAGIC, 4) != 0 ||
+      header[4] != STATIONCACHE_VERSION) {
+    ERROR("%s isn't a station cache, ignoring it.\n", path);
+    fclose(f);
+    return false;
+  }
+
+  count = _stationcache_get_u32(header + 8);
+
+  // read into a scratch copy, so a short file doesn't leave half of it
+  loaded = (struct stationcache_s *) malloc(sizeof(struct stationcache_s));
+  memset(loaded->num_entries, 0, sizeof(loaded->num_entries));
+
+  for (i = 0; i < count; i++) {
+    if (fread(record, 1, sizeof(record), f) != sizeof(record)) { break; }
+
+    mode = (demod_mode) record[0];
+    if (mode != DEMOD_FM && mode != DEMOD_AM) { continue; }
+
+    bits = _stationcache_get_u32(record + 8);
+    memcpy( & snr, & bits, sizeof(snr));
+
+    _stationcache_insert(loaded, mode, (int) _stationcache_get_u32(record + 4),
+			 snr, (time_t) _stationcache_get_u32(record + 12));
+  }
+
+  fclose(f);
+
+  if (i < count) {
+    ERROR("Station cache %s is truncated, ignoring it.\n", path);
+    free(loaded);
+    return false;
+  }
+
+  pthread_mutex_lock( & sc->m);
+
+  memcpy(sc->entries, loaded->entries, sizeof(sc->entries));
+  memcpy(sc->num_entries, loaded->num_entries, sizeof(sc->num_entries));
+  sc->dirty = false;
+
+  pthread_mutex_unlock( & sc->m);
+
+  // records for other modes are skipped, and duplicates merged
+  for (mode = 0; mode < STATIONCACHE_NUM_MODES; mode++) {
+    num_stations += loaded->num_entries[mode]; }
+
+  free(loaded);
+
+  DEBUG("Loaded %d stations from %s.\n", num_stations, path);
+
+  return true;
+}
+
+/**
+ * Writes the cache out (to a temporary file first, so a crash can't leave a
+ * broken one behind), returns false if it couldn't.
+ */
+bool stationcache_save(stationcache sc, const char * path)
+{
+  char tmp_path[4096];
+  uint8_t header[STATIONCACHE_HEADER_SIZE], record[STATIONCACHE_RECORD_SIZE];
+  struct stationcache_entry_s * e;
+  uint32_t count = 0, bits;
+  bool ok = true;
+  FILE * f;
+  int mode, i;
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+      (int) sizeof(tmp_path)) {
+    ERROR("Station cache path is too long.\n");
+    return false;
+  }
+
+  if ((f = fopen(tmp_path, "wb")) == NULL) {
+    ERROR("Failed to write station cache %s.\n", tmp_path);
+    return false;
+  }
+
+  pthread_mutex_lock( & sc->m);
+
+  for (mode = 0; mode < STATIONCACHE_NUM_MODES; mode++) {
+    count += sc->num_entries[mode]; }
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, STATIONCACHE_MAGIC, 4);
+  header[4] = STATIONCACHE_VERSION;
+  _stationcache_put_u32(header + 8, count);
+
+  ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+
+  for (mode = 0; mode < STATIONCACHE_NUM_MODES && ok; mode++) {
+    for (i = 0; i < sc->num_entries[mode] && ok; i++) {
+      e = & sc->entries[mode][i];
+
+      memset(record, 0, sizeof(record));
+      memcpy( & bits, & e->snr, sizeof(bits));
+
+      record[0] = (uint8_t) mode;
+      _stationcache_put_u32(record + 4, (uint32_t) e->fc);
+      _stationcache_put_u32(record + 8, bits);
+      _stationcache_put_u32(record + 12, (uint32_t) e->seen);
+
+      ok = fwrite(record, 1, sizeof(record), f) == sizeof(record);
+    }
+  }
+
+  if (ok) { sc->dirty = false; }
+
+  pthread_mutex_unlock( & sc->m);
+
+  ok = fclose(f) == 0 && ok;
+
+  if ( ! ok || rename(tmp_path, path) != 0) {
+    ERROR("Failed to write station cache %s.\n", path);
+    remove(tmp_path);
+
+    pthread_mutex_lock( & sc->m);
+    sc->dirty = true;
+    pthread_mutex_unlock( & sc->m);
+
+    return false;
+  }
+
+  return true;
+}
+
+bool stationcache_is_dirty(stationcache sc)
+{
+  bool dirty;
+  pthread_mutex_lock( & sc->m);
+  dirty = sc->dirty;
+  pthread_mutex_unlock( & sc->m);
+  return dirty;
+}
+
+void stationcache_update(stationcache sc, demod_mode mode, int fc, float snr,
+			 bool present)
+{
+  int i;
+
+  if (mode != DEMOD_FM && mode != DEMOD_AM) { return; }
+
+  pthread_mutex_lock( & sc->m);
+
+  if (present) {
+    _stationcache_insert(sc, mode, fc, snr, time(NULL));
+    sc->dirty = true;
+  }
+  else {
+    i = _stationcache_search(sc, mode, fc);
+
+    if (i < sc->num_entries[mode] && sc->entries[mode][i].fc == fc) {
+      memmove(sc->entries[mode] + i, sc->entries[mode] + i + 1,
+	      (sc->num_entries[mode] - i - 1) * sizeof(struct stationcache_entry_s));
+      sc->num_entries[mode]--;
+      sc->dirty = true;
+    }
+  }
+
+  pthread_mutex_unlock( & sc->m);
+}
+
+int stationcache_get(stationcache sc, demod_mode mode, int * fcs, int len)
+{
+  int i, n;
+
+  if (mode != DEMOD_FM && mode != DEMOD_AM) { return 0; }
+
+  pthread_mutex_lock( & sc->m);
+
+  n = sc->num_entries[mode] < len ? sc->num_entries[mode] : len;
+  for (i = 0; i < n; i++) { fcs[i] = sc->entries[mode][i].fc; }
+
+  pthread_mutex_unlock( & sc->m);
+
+  return n;
+}
+
+bool stationcache_contains(stationcache sc, demod_mode mode, int fc)
+{
+  bool found;
+  int i;
+
+  if (mode != DEMOD_FM && mode != DEMOD_AM) { return false; }
+
+  pthread_mutex_lock( & sc->m);
+
+  i = _stationcache_search(sc, mode, fc);
+  found = i < sc->num_entries[mode] && sc->entries[mode][i].fc == fc;
+
+  pthread_mutex_unlock( & sc->m);
+
+  return found;
+}
+
+int stationcache_find_next(stationcache sc, demod_mode mode, int fc,
+			   int direction, bool * wrapped)
+{
+  int n, i, next = -1;
+
+  * wrapped = false;
+
+  if (mode != DEMOD_FM && mode != DEMOD_AM) { return -1; }
+
+  pthread_mutex_lock( & sc->m);
+
+  n = sc->num_entries[mode];
+  i = _stationcache_search(sc, mode, fc);
+
+  if (direction > 0) {
+    // first one above fc, else the lowest
+    if (i < n && sc->entries[mode][i].fc == fc) { i++; }
+    if (i == n) {
+      i = 0;
+      * wrapped = true;
+    }
+  }
+  else {
+    // last one below fc, else the highest
+    if (--i < 0) {
+      i = n - 1;
+      * wrapped = true;
+    }
+  }
+
+  if (n > 0 && sc->entries[mode][i].fc != fc) { next = sc->entries[mode][i].fc; }
+
+  pthread_mutex_unlock( & sc->m);
+
+  return next;
+}
@@ -1,34 +1,119 @@
 #include <errno.h>
 #include <libwebsockets.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "codec.h"
+#include "config.h"
 #include "macros.h"
-#include "rtl.h"
+#include "spectrum.h"
 #include "websocket.h"
 
-#define WEBSOCKET_MAX_HEADER_LENGTH 1024
-#define WEBSOCKET_MAX_BUFFER_LENGTH (LWS_SEND_BUFFER_PRE_PADDING + \
-				     WEBSOCKET_MAX_HEADER_LENGTH + \
-				     RTL_MAX_BUFFER_LENGTH * sizeof(int16_t) + \
-				     LWS_SEND_BUFFER_POST_PADDING)
+// the largest header written in front of a frame's data (the spectrum's is
+// the same size)
+#define WEBSOCKET_MAX_HEADER_SIZE sizeof(struct websocket_audio_s)
+
+// room needed in front of a frame's data: libwebsockets' own framing, then
+// our header
+#define WEBSOCKET_HEADROOM (LWS_SEND_BUFFER_PRE_PADDING + \
+			    WEBSOCKET_MAX_HEADER_SIZE)
+
+// frames built in their own buffer start out big enough for telemetry
+#define WEBSOCKET_SMALL_BUFFER_LENGTH (WEBSOCKET_HEADROOM + \
+				       sizeof(struct websocket_telemetry_s) + \
+				       LWS_SEND_BUFFER_POST_PADDING)
+
+// enough frames for every client's queue and slots (with each client on its
+// own stream) plus one being written to each client
+#define WEBSOCKET_NUM_FRAMES ((WEBSOCKET_CLIENT_DEPTH + WEBSOCKET_NUM_SLOTS + \
+			       1) * WEBSOCKET_MAX_CLIENTS + 1)
 
 typedef enum { WEBSOCKET_HALTED, WEBSOCKET_RUNNING, WEBSOCKET_EXITING }
   websocket_state;
 
+/**
+ * A message ready to be written: start has LWS_SEND_BUFFER_PRE_PADDING bytes
+ * free before it and LWS_SEND_BUFFER_POST_PADDING after its size bytes. It's
+ * built once and shared by every client queue it's on; data sent by
+ * reference is handed back through the release callback when the last one's
+ * done with it.
+ */
+struct websocket_frame_s
+{
+  unsigned char * start;
+  size_t size;
+  int refs;
+  void * release_arg; // NULL if it's built in buf
+  unsigned char * buf;
+  size_t buf_cap;
+};
+
+/**
+ * Audio encoded once for all the clients that asked for the same codec and
+ * rate. Clients taking the int16 audio as is don't have one, they're sent the
+ * sender's data by reference.
+ */
+struct websocket_stream_s
+{
+  codec c; // NULL if the slot's free
+  int users;
+};
+
+/**
+ * A connection's frames waiting to be written. When a client can't keep up
+ * its oldest frame is dropped, without holding up anyone else. State messages
+ * and spectrum frames aren't queued with the rest, a newer one just replaces
+ * the one in its slot, so the latest can't be dropped; they go out ahead of
+ * the queue.
+ */
+struct per_session_data_sdr
+{
+  struct libwebsocket * wsi;
+  int id;
+  bool connected; // accepted, and in the client list
+
+  // what it's asked for
+  codec_type type;
+  unsigned int decim;
+  struct websocket_stream_s * stream;
+
+  // spectrum frames, if it wants them (0 bins if not), and when it was sent
+  // the last one
+  unsigned int spectrum_bins;
+  float spectrum_period; // s
+  struct timespec spectrum_time;
+
+  struct websocket_frame_s * queue[WEBSOCKET_CLIENT_DEPTH];
+  unsigned int head;
+  unsigned int len;
+
+  struct websocket_frame_s * slots[WEBSOCKET_NUM_SLOTS]; // NULL if sent
+
+  unsigned int sent;
+  unsigned int dropped;
+};
+
 struct websocket_s
 {
-  unsigned char output[WEBSOCKET_MAX_BUFFER_LENGTH];
-  size_t output_size;
-  enum libwebsocket_write_protocol output_protocol;
+  struct websocket_frame_s frames[WEBSOCKET_NUM_FRAMES];
+  struct per_session_data_sdr * clients[WEBSOCKET_MAX_CLIENTS];
+  int num_clients;
+  int next_id; // also how many connections there have been
+  struct websocket_stream_s streams[WEBSOCKET_MAX_CLIENTS];
+  unsigned int drops; // frames dropped, over every client there's been
   pthread_mutex_t output_m;
-  
-  sem_t output_sem; // eventually implement a queue?
-  
+
+  // held by the sender while it encodes and by whatever changes the streams
+  // (always taken before output_m), so encoding doesn't hold output_m
+  pthread_mutex_t codec_m;
+
+  websocket_release_callback release_callback;
+  void * release_ctx;
+
   websocket_receive_callback receive_callback;
   void * receive_ctx;
   pthread_mutex_t receive_callback_m; // not really needed
@@ -56,18 +141,240 @@ void _websocket_set_state(websocket ws, websocket_state state)
   pthread_mutex_unlock( & ws->state_m);
 }
 
+// call with output_m held
+static bool _websocket_client_is_waiting(struct per_session_data_sdr * client)
+{
+  int i;
+
+  for (i = 0; i < WEBSOCKET_NUM_SLOTS; i++) {
+    if (client->slots[i] != NULL) { return true; } }
+
+  return client->len > 0;
+}
+
+/**
+ * Asks libwebsockets to tell us when every client with frames waiting can be
+ * written to. Only call it from the service thread.
+ */
+static void _websocket_request_writes(websocket ws)
+{
+  struct libwebsocket * waiting[WEBSOCKET_MAX_CLIENTS];
+  int i, num_waiting = 0;
+
+  pthread_mutex_lock( & ws->output_m);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    if (_websocket_client_is_waiting(ws->clients[i])) {
+      waiting[num_waiting++] = ws->clients[i]->wsi; }
+  }
+
+  pthread_mutex_unlock( & ws->output_m);
+
+  // clients only come and go on this thread, so they're still there
+  for (i = 0; i < num_waiting; i++) {
+    libwebsocket_callback_on_writable(ws->context, waiting[i]); }
+}
+
+/**
+ * Sleeps until there's socket activity, or a frame's queued (the sender
+ * cancels the wait), so frames go out as soon as they're ready.
+ */
 static void * _websocket_thread_fn(void * ctx)
 {
   websocket ws = (websocket) ctx;
   
   while (_websocket_get_state(ws) != WEBSOCKET_EXITING) {
-    libwebsocket_service(ws->context, 50);
+    _websocket_request_writes(ws);
+    libwebsocket_service(ws->context, -1);
   }
   
   return NULL;
 }
 
-struct per_session_data_sdr {};
+/**
+ * Drops a reference to a frame, handing data sent by reference back to its
+ * owner with the last one. Call with output_m held.
+ */
+static void _websocket_unref_frame(websocket ws,
+				   struct websocket_frame_s * frame)
+{
+  if (--frame->refs > 0) { return; }
+
+  if (frame->release_arg != NULL && ws->release_callback != NULL) {
+    ws->release_callback(frame->release_arg, ws->release_ctx); }
+
+  frame->release_arg = NULL;
+}
+
+static struct websocket_frame_s *
+_websocket_client_pop(struct per_session_data_sdr * client)
+{
+  struct websocket_frame_s * frame;
+
+  if (client->len == 0) { return NULL; }
+
+  frame = client->queue[client->head];
+  client->head = (client->head + 1) % WEBSOCKET_CLIENT_DEPTH;
+  client->len--;
+
+  return frame;
+}
+
+static void _websocket_client_push(websocket ws,
+				   struct per_session_data_sdr * client,
+				   struct websocket_frame_s * frame)
+{
+  if (client->len == WEBSOCKET_CLIENT_DEPTH) {
+    _websocket_unref_frame(ws, _websocket_client_pop(client));
+    client->dropped++;
+    ws->drops++;
+  }
+
+  client->queue[(client->head + client->len) % WEBSOCKET_CLIENT_DEPTH] = frame;
+  client->len++;
+  frame->refs++;
+}
+
+// the next frame to write, state messages first
+static struct websocket_frame_s *
+_websocket_client_next(struct per_session_data_sdr * client)
+{
+  struct websocket_frame_s * frame;
+  int i;
+
+  for (i = 0; i < WEBSOCKET_NUM_SLOTS; i++) {
+    if ((frame = client->slots[i]) != NULL) {
+      client->slots[i] = NULL;
+      return frame;
+    }
+  }
+
+  return _websocket_client_pop(client);
+}
+
+// replaces whatever's in the slot that hasn't been written yet
+static void _websocket_client_put(websocket ws,
+				  struct per_session_data_sdr * client,
+				  websocket_slot slot,
+				  struct websocket_frame_s * frame)
+{
+  if (client->slots[slot] != NULL) {
+    _websocket_unref_frame(ws, client->slots[slot]); }
+
+  client->slots[slot] = frame;
+  frame->refs++;
+}
+
+/**
+ * Moves a client to the stream for its codec and rate, creating the stream if
+ * it's the first. Call with codec_m and output_m held.
+ */
+static void _websocket_attach_stream(websocket ws,
+				     struct per_session_data_sdr * client)
+{
+  struct websocket_stream_s * stream = NULL;
+  codec c;
+  int i;
+
+  if (client->stream != NULL && --client->stream->users == 0) {
+    codec_destroy(client->stream->c);
+    client->stream->c = NULL;
+  }
+
+  client->stream = NULL;
+
+  if (client->type == CODEC_PCM16 && client->decim == 1) { return; }
+
+  for (i = 0; i < WEBSOCKET_MAX_CLIENTS; i++) {
+    c = ws->streams[i].c;
+
+    if (c != NULL && codec_get_type(c) == client->type &&
+	codec_get_decim(c) == client->decim) {
+      stream = & ws->streams[i];
+      break;
+    }
+
+    if (c == NULL && stream == NULL) { stream = & ws->streams[i]; }
+  }
+
+  if (stream->c == NULL) {
+    stream->c = codec_create(client->type, client->decim);
+    stream->users = 0;
+  }
+
+  stream->users++;
+  client->stream = stream;
+}
+
+// call with output_m held
+static struct per_session_data_sdr * _websocket_find_client(websocket ws,
+							    int id)
+{
+  int i;
+
+  for (i = 0; i < ws->num_clients; i++) {
+    if (ws->clients[i]->id == id) { return ws->clients[i]; } }
+
+  return NULL;
+}
+
+// call with output_m held
+static int _websocket_add_client(websocket ws,
+				 struct per_session_data_sdr * client,
+				 struct libwebsocket * wsi)
+{
+  client->wsi = wsi;
+  client->id = ws->next_id++;
+  client->connected = false;
+  client->type = CODEC_PCM16;
+  client->decim = 1;
+  client->stream = NULL;
+  client->spectrum_bins = 0;
+  client->spectrum_period = 0.0f;
+  client->spectrum_time.tv_sec = 0;
+  client->spectrum_time.tv_nsec = 0;
+  client->head = 0;
+  client->len = 0;
+  memset(client->slots, 0, sizeof(client->slots));
+  client->sent = 0;
+  client->dropped = 0;
+
+  if (ws->num_clients == WEBSOCKET_MAX_CLIENTS) { return -1; }
+
+  ws->clients[ws->num_clients++] = client;
+  client->connected = true;
+
+  return 0;
+}
+
+// call with codec_m and output_m held
+static void _websocket_remove_client(websocket ws,
+				     struct per_session_data_sdr * client)
+{
+  struct websocket_frame_s * frame;
+  int i;
+
+  if ( ! client->connected) { return; }
+
+  while ((frame = _websocket_client_next(client)) != NULL) {
+    _websocket_unref_frame(ws, frame); }
+
+  client->type = CODEC_PCM16;
+  client->decim = 1;
+  _websocket_attach_stream(ws, client);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    if (ws->clients[i] == client) {
+      ws->clients[i] = ws->clients[--ws->num_clients];
+      break;
+    }
+  }
+
+  client->connected = false;
+
+  DEBUG("Client closed, %u frames sent, %u dropped.\n",
+	client->sent, client->dropped);
+}
 
 static int _websocket_sdr_callback(struct libwebsocket_context * ctx,
 				   struct libwebsocket * wsi,
@@ -77,54 +384,68 @@ static int _websocket_sdr_callback(struct libwebsocket_context * ctx,
 				   size_t received_len)
 {
   websocket ws = (websocket) libwebsocket_context_user(ctx);
+  struct per_session_data_sdr * client = (struct per_session_data_sdr *) arg;
   
-  int err;
+  struct websocket_frame_s * frame;
+  bool more;
   int n;
   int status = 0;
 
-  // we only support one connection, at least for now
-  static struct libwebsocket * primary_wsi = NULL;
-
-  // ignore any others
-  if (primary_wsi != NULL && wsi != NULL && primary_wsi != wsi) { return -1; }
-  
   switch (reason) {
   case LWS_CALLBACK_ESTABLISHED:
-    primary_wsi = wsi;
+    pthread_mutex_lock( & ws->output_m);
+    n = _websocket_add_client(ws, client, wsi);
+    pthread_mutex_unlock( & ws->output_m);
+
+    if (n < 0) {
+      ERROR("Too many clients, refusing another.\n");
+      status = -1;
+    }
     break;
     
   case LWS_CALLBACK_SERVER_WRITEABLE:
-    err = sem_trywait( & ws->output_sem);
-    if (err != 0) { break; }
-    
+    // the frame's ours (and won't change) until we unref it
     pthread_mutex_lock( & ws->output_m);
-
-    n = libwebsocket_write(wsi,
-			   (unsigned char *) & ws->output[LWS_SEND_BUFFER_PRE_PADDING],
-			   ws->output_size,
-			   ws->output_protocol);
-    
+    frame = _websocket_client_next(client);
     pthread_mutex_unlock( & ws->output_m);
 
+    if (frame == NULL) { break; }
+
+    // straight out of the sender's buffer
+    n = libwebsocket_write(wsi, frame->start, frame->size, LWS_WRITE_BINARY);
+
     if (n < 0) {
       ERROR("problem writing to socket\n");
       status = -1;
     }
-    else if (n < (int) ws->output_size) {
+    else if (n < (int) frame->size) {
       ERROR("partial write\n");
       status = -1;
     }
+
+    pthread_mutex_lock( & ws->output_m);
+    client->sent++;
+    _websocket_unref_frame(ws, frame);
+    more = _websocket_client_is_waiting(client);
+    pthread_mutex_unlock( & ws->output_m);
+
+    if (more && status == 0) { libwebsocket_callback_on_writable(ctx, wsi); }
     
     break;
     
   case LWS_CALLBACK_RECEIVE:
     if (ws->receive_callback != NULL) {
-      ws->receive_callback(received, received_len, ws->receive_ctx);
+      ws->receive_callback(received, received_len, client->id,
+			   ws->receive_ctx);
     }
     break;
     
   case LWS_CALLBACK_CLOSED:
-    primary_wsi = NULL;
+    pthread_mutex_lock( & ws->codec_m);
+    pthread_mutex_lock( & ws->output_m);
+    _websocket_remove_client(ws, client);
+    pthread_mutex_unlock( & ws->output_m);
+    pthread_mutex_unlock( & ws->codec_m);
     break;
     
   case LWS_CALLBACK_GET_THREAD_ID:
@@ -133,15 +454,6 @@ static int _websocket_sdr_callback(struct libwebsocket_context * ctx,
     
   default: break;
   }
-
-  // TODO this can probably be improved
-  if (primary_wsi != NULL && reason <= LWS_CALLBACK_GET_THREAD_ID) {
-    sem_getvalue( & ws->output_sem, & n);
-    
-    if (n > 0) {
-      libwebsocket_callback_on_writable(ctx, primary_wsi);
-    }
-  }
   
   return status;
 }
@@ -159,6 +471,7 @@ static struct libwebsocket_protocols _websocket_protocols[] = {
 websocket websocket_create()
 {
   websocket ws = (websocket) malloc(sizeof(struct websocket_s));
+  int i;
 
   struct lws_context_creation_info * info =
     malloc(sizeof(struct lws_context_creation_info));
@@ -198,29 +511,55 @@ websocket websocket_create()
 
   ws->receive_callback = NULL;
   ws->receive_ctx = NULL;
+  ws->release_callback = NULL;
+  ws->release_ctx = NULL;
+
+  for (i = 0; i < WEBSOCKET_NUM_FRAMES; i++) {
+    ws->frames[i].refs = 0;
+    ws->frames[i].release_arg = NULL;
+    ws->frames[i].buf_cap = WEBSOCKET_SMALL_BUFFER_LENGTH;
+    ws->frames[i].buf = (unsigned char *) malloc(ws->frames[i].buf_cap);
+  }
+
+  for (i = 0; i < WEBSOCKET_MAX_CLIENTS; i++) { ws->streams[i].c = NULL; }
+
+  ws->num_clients = 0;
+  ws->next_id = 0;
+  ws->drops = 0;
 
   ws->state = WEBSOCKET_HALTED;
   
   pthread_mutex_init( & ws->output_m, NULL);
+  pthread_mutex_init( & ws->codec_m, NULL);
   pthread_mutex_init( & ws->state_m, NULL);
   
-  sem_init( & ws->output_sem, 0, 0);
-  
   return ws;
 }
 
 void websocket_destroy(websocket ws)
 {
+  bool running = _websocket_get_state(ws) == WEBSOCKET_RUNNING;
+  int i;
+
   _websocket_set_state(ws, WEBSOCKET_EXITING);
 
+  // wake the service thread so it sees we're exiting
+  if (running) {
+    libwebsocket_cancel_service(ws->context);
+    pthread_join(ws->thread, NULL);
+  }
+
   libwebsocket_context_destroy(ws->context);
 
-  pthread_join(ws->thread, NULL);
+  // anything still waiting goes back to its owner
+  while (ws->num_clients > 0) { _websocket_remove_client(ws, ws->clients[0]); }
+
+  for (i = 0; i < WEBSOCKET_NUM_FRAMES; i++) { free(ws->frames[i].buf); }
+
   pthread_mutex_destroy( & ws->output_m);
+  pthread_mutex_destroy( & ws->codec_m);
   pthread_mutex_destroy( & ws->state_m);
   
-  sem_destroy( & ws->output_sem);
-  
   free(ws);
 }
 
@@ -237,34 +576,523 @@ void websocket_execute(websocket ws, websocket_receive_callback cb, void * ctx)
   pthread_create( & ws->thread, NULL, _websocket_thread_fn, (void *) ws);
 }
 
-void websocket_send(websocket ws,
-		    void * header,
-		    size_t header_size,
-		    void * data,
-		    size_t data_size)
+/**
+ * Audio sent by reference (websocket_send_audio) needs this much room free in
+ * front of it, and websocket_get_tailroom after it.
+ */
+size_t websocket_get_headroom()
+{
+  return WEBSOCKET_HEADROOM;
+}
+
+size_t websocket_get_tailroom()
+{
+  return LWS_SEND_BUFFER_POST_PADDING;
+}
+
+/**
+ * Called with every arg given to websocket_send_audio once the data's been
+ * written to every client that needed it (or dropped).
+ */
+void websocket_set_release_callback(websocket ws,
+				    websocket_release_callback cb,
+				    void * ctx)
+{
+  ws->release_callback = cb;
+  ws->release_ctx = ctx;
+}
+
+/**
+ * Takes a free frame to build the next message in, NULL if every frame is
+ * still queued (which shouldn't happen). It's the caller's (and can be built
+ * without output_m) until it's published. Call with output_m held.
+ */
+static struct websocket_frame_s * _websocket_claim_frame(websocket ws)
+{
+  int i;
+
+  for (i = 0; i < WEBSOCKET_NUM_FRAMES; i++) {
+    if (ws->frames[i].refs == 0) {
+      ws->frames[i].refs = 1;
+      return & ws->frames[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Queues a claimed frame for every client on the stream, giving up the
+ * claim; with none it's released straight away. Call with output_m held.
+ */
+static void _websocket_publish_frame(websocket ws,
+				     struct websocket_stream_s * stream,
+				     struct websocket_frame_s * frame)
+{
+  int i;
+
+  for (i = 0; i < ws->num_clients; i++) {
+    if (ws->clients[i]->stream == stream) {
+      _websocket_client_push(ws, ws->clients[i], frame); }
+  }
+
+  _websocket_unref_frame(ws, frame);
+}
+
+/**
+ * Wakes the service thread to pick up newly queued frames, if anyone's
+ * listening.
+ */
+static void _websocket_wake(websocket ws)
 {
+  bool listening;
+
   pthread_mutex_lock( & ws->output_m);
-  
-  ws->output_protocol = LWS_WRITE_BINARY;
-  ws->output_size = sizeof(uint32_t) + header_size + data_size;
-  
-  void * dest = (void *) & ws->output[LWS_SEND_BUFFER_PRE_PADDING];
-  
-  // write header size
-  uint32_t tmp = header_size;
-  memcpy(dest, & tmp, sizeof(uint32_t));
+  listening = ws->num_clients > 0;
+  pthread_mutex_unlock( & ws->output_m);
+
+  if (listening) { libwebsocket_cancel_service(ws->context); }
+}
+
+/**
+ * Frames data_size bytes at data (with the head- and tailroom around it),
+ * writing the header (up to WEBSOCKET_MAX_HEADER_SIZE) just in front of it.
+ */
+static void _websocket_build_frame(struct websocket_frame_s * frame,
+				   const void * header,
+				   size_t header_size,
+				   unsigned char * data,
+				   size_t data_size,
+				   void * release_arg)
+{
+  unsigned char * start = data - header_size;
+
+  memcpy(start, header, header_size);
+
+  frame->start = start;
+  frame->size = header_size + data_size;
+  frame->release_arg = release_arg;
+}
+
+static void _websocket_init_header(struct websocket_header_s * header,
+				   websocket_msg_type type)
+{
+  header->version = WEBSOCKET_PROTOCOL_VERSION;
+  header->type = (uint8_t) type;
+  header->reserved = 0;
+}
+
+/**
+ * Room for size bytes of data in the frame's own buffer, with the head- and
+ * tailroom around it.
+ */
+static unsigned char * _websocket_reserve(struct websocket_frame_s * frame,
+					  size_t size)
+{
+  size_t cap = WEBSOCKET_HEADROOM + size + LWS_SEND_BUFFER_POST_PADDING;
+
+  if (frame->buf_cap < cap) {
+    frame->buf = (unsigned char *) realloc(frame->buf, cap);
+    frame->buf_cap = cap;
+  }
+
+  return frame->buf + WEBSOCKET_HEADROOM;
+}
+
+/**
+ * Builds and queues one stream's frame: the audio encoded for it, or by
+ * reference for clients taking it as is (a NULL stream), or just how many
+ * samples of silence there are. Call with codec_m held; output_m is only
+ * taken to claim and publish the frame, not while encoding.
+ */
+static void _websocket_send_stream(websocket ws,
+				   struct websocket_stream_s * stream,
+				   const struct websocket_audio_s * header,
+				   int16_t * x,
+				   unsigned int n,
+				   bool silent,
+				   void * arg)
+{
+  struct websocket_audio_s audio = * header;
+  struct websocket_frame_s * frame;
+  unsigned char * data = (unsigned char *) x;
+  size_t data_size = n * sizeof(int16_t);
+  unsigned int num_samples = n;
+
+  pthread_mutex_lock( & ws->output_m);
+
+  if ((frame = _websocket_claim_frame(ws)) == NULL) {
+    ERROR("No websocket frames free, dropping one.\n");
+    ws->drops++;
+
+    if (arg != NULL && ws->release_callback != NULL) {
+      ws->release_callback(arg, ws->release_ctx); }
+
+    pthread_mutex_unlock( & ws->output_m);
+    return;
+  }
 
-  // write header
-  memcpy(dest + sizeof(uint32_t), header, header_size);
-  
-  // write data
-  memcpy(dest + sizeof(uint32_t) + header_size, data, data_size);
-  
   pthread_mutex_unlock( & ws->output_m);
-  
-  int val;
-  sem_getvalue( & ws->output_sem, & val);
 
-  // discard if not ready
-  if (val == 0) { sem_post( & ws->output_sem); }
+  if (stream != NULL) { audio.format = codec_get_format(stream->c); }
+
+  if (silent) {
+    if (stream != NULL) { num_samples = codec_skip(stream->c, n); }
+
+    data = _websocket_reserve(frame, 0);
+    data_size = 0;
+  }
+  else if (stream != NULL) {
+    data = _websocket_reserve(frame, codec_get_max_size(stream->c, n));
+    data_size = codec_encode(stream->c, x, n, data, & num_samples);
+  }
+
+  audio.num_samples = num_samples;
+
+  _websocket_build_frame(frame, & audio, sizeof(audio), data, data_size, arg);
+
+  pthread_mutex_lock( & ws->output_m);
+  _websocket_publish_frame(ws, stream, frame);
+  pthread_mutex_unlock( & ws->output_m);
+}
+
+// the audio header common to every stream, for the codec to fill in
+static void _websocket_init_audio(struct websocket_audio_s * audio,
+				  uint32_t seq,
+				  const struct timespec * time,
+				  bool silent)
+{
+  _websocket_init_header( & audio->header, WEBSOCKET_MSG_AUDIO);
+  audio->seq = seq;
+  audio->num_samples = 0;
+  audio->format = 0;
+  audio->flags = silent ? WEBSOCKET_AUDIO_SILENT : 0;
+  audio->reserved = 0;
+  audio->time = (uint64_t) time->tv_sec * 1000000 + time->tv_nsec / 1000;
+}
+
+/**
+ * Sends a block of audio (seq and time as the demod gave them) to every
+ * client, encoded once per stream. n samples of int16 audio, used without
+ * copying for clients taking it as is, so it must have websocket_get_headroom
+ * bytes free before it and websocket_get_tailroom after (all of it's the
+ * sender's to overwrite). The data is passed back with arg to the release
+ * callback when it's no longer needed.
+ */
+void websocket_send_audio(websocket ws,
+			  uint32_t seq,
+			  const struct timespec * time,
+			  int16_t * data,
+			  unsigned int n,
+			  void * arg)
+{
+  struct websocket_audio_s audio;
+  bool raw = false;
+  int i;
+
+  _websocket_init_audio( & audio, seq, time, false);
+
+  // the streams (and who's on them) stay put while codec_m's held
+  pthread_mutex_lock( & ws->codec_m);
+
+  for (i = 0; i < WEBSOCKET_MAX_CLIENTS; i++) {
+    if (ws->streams[i].c != NULL) {
+      _websocket_send_stream(ws, & ws->streams[i], & audio, data, n, false,
+			     NULL);
+    }
+  }
+
+  pthread_mutex_lock( & ws->output_m);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    raw |= ws->clients[i]->stream == NULL; }
+
+  pthread_mutex_unlock( & ws->output_m);
+
+  if (raw) { _websocket_send_stream(ws, NULL, & audio, data, n, false, arg); }
+  else if (ws->release_callback != NULL) {
+    ws->release_callback(arg, ws->release_ctx); }
+
+  pthread_mutex_unlock( & ws->codec_m);
+
+  _websocket_wake(ws);
+}
+
+/**
+ * Sends just the audio header, flagged WEBSOCKET_AUDIO_SILENT, with how many
+ * samples of silence there are in place of the audio.
+ */
+void websocket_send_silence(websocket ws,
+			    uint32_t seq,
+			    const struct timespec * time,
+			    unsigned int n)
+{
+  struct websocket_audio_s audio;
+  int i;
+
+  _websocket_init_audio( & audio, seq, time, true);
+
+  pthread_mutex_lock( & ws->codec_m);
+
+  for (i = 0; i < WEBSOCKET_MAX_CLIENTS; i++) {
+    if (ws->streams[i].c != NULL) {
+      _websocket_send_stream(ws, & ws->streams[i], & audio, NULL, n, true,
+			     NULL);
+    }
+  }
+
+  _websocket_send_stream(ws, NULL, & audio, NULL, n, true, NULL);
+
+  pthread_mutex_unlock( & ws->codec_m);
+
+  _websocket_wake(ws);
+}
+
+/**
+ * Sends a message (one of the websocket_msg_type structs and whatever
+ * follows it, already filled in) to every client, copying it. It takes the
+ * place of any message in the same slot a client hasn't been sent yet.
+ */
+void websocket_send_state(websocket ws,
+			  websocket_slot slot,
+			  const void * msg,
+			  size_t size)
+{
+  struct websocket_frame_s * frame;
+  unsigned char * data;
+  int i;
+
+  pthread_mutex_lock( & ws->output_m);
+
+  if (ws->num_clients == 0) {
+    pthread_mutex_unlock( & ws->output_m);
+    return;
+  }
+
+  if ((frame = _websocket_claim_frame(ws)) == NULL) {
+    ERROR("No websocket frames free, dropping one.\n");
+    ws->drops++;
+    pthread_mutex_unlock( & ws->output_m);
+    return;
+  }
+
+  data = _websocket_reserve(frame, size);
+  memcpy(data, msg, size);
+  _websocket_build_frame(frame, NULL, 0, data, size, NULL);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    _websocket_client_put(ws, ws->clients[i], slot, frame); }
+
+  _websocket_unref_frame(ws, frame);
+
+  pthread_mutex_unlock( & ws->output_m);
+
+  _websocket_wake(ws);
+}
+
+/**
+ * Picks how a client's audio is encoded, id as given to the receive callback.
+ */
+void websocket_set_client_codec(websocket ws, int id, codec_type type)
+{
+  struct per_session_data_sdr * client;
+
+  pthread_mutex_lock( & ws->codec_m);
+  pthread_mutex_lock( & ws->output_m);
+
+  if ((client = _websocket_find_client(ws, id)) != NULL) {
+    client->type = type;
+    _websocket_attach_stream(ws, client);
+  }
+
+  pthread_mutex_unlock( & ws->output_m);
+  pthread_mutex_unlock( & ws->codec_m);
+}
+
+/**
+ * Has a client's audio decimated by decim (1 to CODEC_MAX_DECIM) before it's
+ * encoded.
+ */
+void websocket_set_client_decim(websocket ws, int id, unsigned int decim)
+{
+  struct per_session_data_sdr * client;
+
+  if (decim < 1 || decim > CODEC_MAX_DECIM) { return; }
+
+  pthread_mutex_lock( & ws->codec_m);
+  pthread_mutex_lock( & ws->output_m);
+
+  if ((client = _websocket_find_client(ws, id)) != NULL) {
+    client->decim = decim;
+    _websocket_attach_stream(ws, client);
+  }
+
+  pthread_mutex_unlock( & ws->output_m);
+  pthread_mutex_unlock( & ws->codec_m);
+}
+
+/**
+ * Has a client sent the spectrum with the given resolution, at up to rate
+ * frames a second (0 stops it).
+ */
+void websocket_set_client_spectrum(websocket ws, int id, unsigned int bins,
+				   float rate)
+{
+  struct per_session_data_sdr * client;
+
+  if (rate > WEBSOCKET_SPECTRUM_MAX_RATE) { rate = WEBSOCKET_SPECTRUM_MAX_RATE; }
+
+  pthread_mutex_lock( & ws->output_m);
+
+  if ((client = _websocket_find_client(ws, id)) != NULL) {
+    client->spectrum_bins = rate > 0.0f ? bins : 0;
+    client->spectrum_period = rate > 0.0f ? 1.0f / rate : 0.0f;
+  }
+
+  pthread_mutex_unlock( & ws->output_m);
+}
+
+// call with output_m held
+static bool _websocket_is_spectrum_due(struct per_session_data_sdr * client,
+				       const struct timespec * time)
+{
+  float dt;
+
+  if (client->spectrum_bins == 0) { return false; }
+
+  dt = (time->tv_sec - client->spectrum_time.tv_sec);
+  dt += (time->tv_nsec - client->spectrum_time.tv_nsec) / 1e9;
+
+  return dt >= client->spectrum_period;
+}
+
+/**
+ * Whether any client wants the spectrum at all.
+ */
+bool websocket_wants_spectrum(websocket ws)
+{
+  bool wants = false;
+  int i;
+
+  pthread_mutex_lock( & ws->output_m);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    wants |= ws->clients[i]->spectrum_bins > 0; }
+
+  pthread_mutex_unlock( & ws->output_m);
+
+  return wants;
+}
+
+/**
+ * Whether any client's due another spectrum frame.
+ */
+bool websocket_is_spectrum_due(websocket ws)
+{
+  struct timespec time;
+  bool due = false;
+  int i;
+
+  clock_gettime(CLOCK_REALTIME_COARSE, & time);
+
+  pthread_mutex_lock( & ws->output_m);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    due |= _websocket_is_spectrum_due(ws->clients[i], & time); }
+
+  pthread_mutex_unlock( & ws->output_m);
+
+  return due;
+}
+
+/**
+ * Sends n bins of power (dB) around fc, fs wide, to every client that's due a
+ * spectrum frame, each at its own resolution and quantized to bytes over
+ * WEBSOCKET_SPECTRUM_MIN_DB to WEBSOCKET_SPECTRUM_MAX_DB.
+ */
+void websocket_send_spectrum(websocket ws,
+			     uint32_t fc,
+			     uint32_t fs,
+			     const float * power,
+			     unsigned int n)
+{
+  struct per_session_data_sdr * client;
+  struct websocket_spectrum_s header;
+  struct websocket_frame_s * frame;
+  struct timespec time;
+  unsigned char * data;
+  int i;
+
+  _websocket_init_header( & header.header, WEBSOCKET_MSG_SPECTRUM);
+  header.fc = fc;
+  header.fs = fs;
+  header.min_db = WEBSOCKET_SPECTRUM_MIN_DB;
+  header.max_db = WEBSOCKET_SPECTRUM_MAX_DB;
+  header.reserved = 0;
+
+  clock_gettime(CLOCK_REALTIME_COARSE, & time);
+
+  pthread_mutex_lock( & ws->output_m);
+
+  for (i = 0; i < ws->num_clients; i++) {
+    client = ws->clients[i];
+
+    if ( ! _websocket_is_spectrum_due(client, & time)) { continue; }
+
+    // it'll be due again next time
+    if ((frame = _websocket_claim_frame(ws)) == NULL) { break; }
+
+    data = _websocket_reserve(frame, client->spectrum_bins);
+    spectrum_quantize(power, n, data, client->spectrum_bins,
+		      WEBSOCKET_SPECTRUM_MIN_DB, WEBSOCKET_SPECTRUM_MAX_DB);
+
+    header.num_bins = (uint16_t) client->spectrum_bins;
+
+    _websocket_build_frame(frame, & header, sizeof(header), data,
+			   client->spectrum_bins, NULL);
+
+    // takes the place of one it hasn't been sent yet, rather than pushing
+    // audio out of its queue
+    _websocket_client_put(ws, client, WEBSOCKET_SLOT_SPECTRUM, frame);
+    _websocket_unref_frame(ws, frame);
+
+    client->spectrum_time = time;
+  }
+
+  pthread_mutex_unlock( & ws->output_m);
+
+  _websocket_wake(ws);
+}
+
+int websocket_get_num_clients(websocket ws)
+{
+  int n;
+  pthread_mutex_lock( & ws->output_m);
+  n = ws->num_clients;
+  pthread_mutex_unlock( & ws->output_m);
+  return n;
+}
+
+/**
+ * How many clients have connected so far, to tell when there's a new one.
+ */
+unsigned int websocket_get_connections(websocket ws)
+{
+  unsigned int n;
+  pthread_mutex_lock( & ws->output_m);
+  n = (unsigned int) ws->next_id;
+  pthread_mutex_unlock( & ws->output_m);
+  return n;
+}
+
+/**
+ * Frames dropped because a client couldn't keep up, over all clients.
+ */
+unsigned int websocket_get_drops(websocket ws)
+{
+  unsigned int drops;
+  pthread_mutex_lock( & ws->output_m);
+  drops = ws->drops;
+  pthread_mutex_unlock( & ws->output_m);
+  return drops;
 }